@@ -21,7 +21,29 @@
       "<!@(pkg-config flac --libs)"
     ],
     "target_name": "flac",
-    "sources": [ "src/flac.cpp" ]
+    "sources": [
+      "src/flac.cpp",
+      "src/analyze.cpp",
+      "src/contenthash.cpp",
+      "src/decodefile.cpp",
+      "src/fft.cpp",
+      "src/filedecoder.cpp",
+      "src/fingerprint.cpp",
+      "src/hash.cpp",
+      "src/loudness.cpp",
+      "src/metrics.cpp",
+      "src/mixer.cpp",
+      "src/pack.cpp",
+      "src/peaks.cpp",
+      "src/processor.cpp",
+      "src/replaygain.cpp",
+      "src/resampler.cpp",
+      "src/ring.cpp",
+      "src/silence.cpp",
+      "src/spectrogram.cpp",
+      "src/trace.cpp",
+      "src/transcode.cpp"
+    ]
   }
   ]
 }
@@ -1,51 +1,957 @@
-/*global require,module*/
+/*global require,module,process,Buffer,SharedArrayBuffer,Atomics*/
 
 "use strict";
 
 const bindings = require("bindings")("flac.node");
-const { Transform } = require("stream");
+const { Readable, Transform } = require("stream");
+const fs = require("fs");
 
 const Types = {
     Format: 0,
     Metadata: 1,
     Data: 2,
     Done: 3,
-    End: 4
+    End: 4,
+    Analysis: 5,
+    Batch: 6,
+    Trace: 7
 };
 
 // TODO: make the flac decoder handle multiple opened streams
+//
+// options, in addition to the Transform ones:
+//   packed24: emit 24 bit samples as packed 3 byte s24le instead of
+//             padding them to 32 bits
+//   resample: { sampleRate, quality } resample on the decoder thread,
+//             quality is one of "fast", "medium" (default) or "best"
+//   channelMap: [2, 0, 1] output channel i is source channel channelMap[i]
+//   matrix:     [[1, 0, 0.7], [0, 1, 0.7]] mixing matrix, one row per
+//               output channel and one column per source channel
+//   downmix:    "stereo" or "mono", fold down using the FLAC channel order
+//   channelMap and matrix only apply when they fit the source channel count
+//   gain:       "track" or "album" to apply the REPLAYGAIN_* tags, a number
+//               for a fixed gain in dB, or { mode, db, preamp, preventClipping }.
+//               preventClipping (default on) limits the gain by the peak tag
+//   analyze:    analyzers to run on the decoded frames, same keys as for
+//               analyze() below. results are emitted as "analysis" at the end
+//   output:     false to skip producing pcm, e.g. when only analyzing
+//   md5:        check the decoded audio against the STREAMINFO md5, the
+//               outcome is reported as md5 in the "analysis" event
+//   trusted:    fast path for trusted sources, no md5 and no metadata
+//               parsing (so no vorbis comments and no replaygain tags)
+//   batch:      deliver everything pending in one native call, with
+//               consecutive pcm joined into one chunk. on unless false
+//   inputBudget: bytes of input queued ahead of the decoder before a write
+//               has to wait for it to catch up (default 256k). 0 makes
+//               every write wait until the decoder ran out of input
+//   trace:      true, or the number of trace events to keep per thread
+//               (default 16384), to record latencies, see trace()
+//   ring:       a SharedArrayBuffer from createRing(), the decoder thread
+//               writes the pcm there instead of pushing it, waiting while
+//               the ring is full. read it with a RingReader from any thread
 class FlacDecoder extends Transform {
     constructor(options) {
         super(options);
 
+        const flacOptions = Object.assign({}, options);
+        if (flacOptions.batch === undefined)
+            flacOptions.batch = true;
+        if (flacOptions.inputBudget === undefined)
+            flacOptions.inputBudget = 256 * 1024;
         this._flac = bindings.Open((type, data) => {
-            //console.log("flac callback", type, typeof this._done, typeof this._flac);
-            switch (type) {
-            case Types.Data:
-                //console.log("push", data.length);
-                this.push(data);
-                break;
-            case Types.Format:
-                this.emit("format", data);
-                break;
-            case Types.Done:
-                let done = this._transformCb;
-                this._transformCb = undefined;
+            if (type === Types.Batch) {
+                for (let i = 0; i < data.length; i += 2)
+                    this._message(data[i], data[i + 1]);
+            } else {
+                this._message(type, data);
+            }
+        }, flacOptions);
+    }
+
+    _message(type, data) {
+        //console.log("flac callback", type, typeof this._done, typeof this._flac);
+        switch (type) {
+        case Types.Data:
+            //console.log("push", data.length);
+            this.push(data);
+            break;
+        case Types.Format:
+            this.emit("format", data);
+            break;
+        case Types.Analysis:
+            this.emit("analysis", data);
+            break;
+        case Types.Done:
+            let done = this._transformCb;
+            this._transformCb = undefined;
+            if (done)
                 done();
-                break;
-            case Types.End:
-                this._flac = undefined;
-                break;
+            break;
+        case Types.Trace:
+            this._trace = data;
+            this.emit("trace", data);
+            break;
+        case Types.End:
+            // the final counters come with the End
+            this._flac = undefined;
+            this._stats = data;
+            if (this._flushCb) {
+                const flushed = this._flushCb;
+                this._flushCb = undefined;
+                flushed();
             }
-        });
+            break;
+        }
     }
 
     _transform(chunk, encoding, done) {
         // console.log("want to transform", chunk.length, typeof done);
-        this._transformCb = done;
-        bindings.Feed(this._flac, chunk);
+        if (!this._flac) {
+            done();
+            return;
+        }
+        // under the budget the chunk is acked at once, otherwise on Done
+        if (bindings.Feed(this._flac, chunk))
+            done();
+        else
+            this._transformCb = done;
         //console.log("fed total", this._cnt);
     }
+
+    // counters of the stream so far, see DecoderStats in src/stats.h. times
+    // are in ns, processNs is part of decodeNs, and the *Peak values are
+    // the most input and undelivered pcm held at once
+    stats() {
+        if (this._flac)
+            return bindings.Stats(this._flac);
+        return this._stats;
+    }
+
+    // with the trace option: histograms of the feed to decode, decode to
+    // deliver and feed to deliver latencies of the pcm, in the same shape
+    // as metrics().frameDecode, and the traceEvents for chromeTrace(). the
+    // final one is also emitted as "trace" when the stream ends
+    trace() {
+        if (this._flac)
+            return bindings.Trace(this._flac);
+        return this._trace;
+    }
+
+    // a destroyed stream hands its decoder back, the native side would
+    // otherwise keep waiting for input and hold the loop open
+    _destroy(err, callback) {
+        if (this._flac) {
+            bindings.Close(this._flac);
+            this._flac = undefined;
+        }
+        callback(err);
+    }
+
+    // the decoder drains its input, the resampler tail and the analysis
+    // come out before the End that completes the flush
+    _flush(callback) {
+        if (!this._flac) {
+            callback();
+            return;
+        }
+        this._flushCb = callback;
+        bindings.Finish(this._flac);
+    }
 };
 
-module.exports = { FlacDecoder: FlacDecoder };
+// decodes source (a path, a Buffer, or a readable stream or other iterable
+// of Buffers) and yields the pcm one chunk at a time:
+//
+//   for await (const pcm of decodeFrames("a.flac", { onFormat })) ...
+//
+// the decoder only runs ahead of the consumer by options.prefetch chunks
+// (default 1), so memory stays bounded however slowly the loop pulls.
+// options are those of FlacDecoder plus prefetch and onFormat(format)
+async function* decodeFrames(source, options) {
+    options = options || {};
+    const prefetch = Math.max(1, options.prefetch || 1);
+    let input;
+    if (typeof source === "string")
+        input = fs.createReadStream(source);
+    else if (Buffer.isBuffer(source))
+        input = Readable.from([source]);
+    else
+        input = source;
+    const chunks = input[Symbol.asyncIterator] ? input[Symbol.asyncIterator]() : input[Symbol.iterator]();
+
+    const frames = [];
+    let flac, finished = false, error, wake;
+    const signal = () => {
+        if (wake) {
+            const w = wake;
+            wake = undefined;
+            w();
+        }
+    };
+    // the decoder ran out of input, give it the next chunk
+    const feed = () => {
+        Promise.resolve(chunks.next()).then(({ value, done }) => {
+            if (done) {
+                // the End comes once the decoder used up what it has
+                if (flac)
+                    bindings.Finish(flac);
+                return;
+            } else if (!value.length) {
+                feed();
+                return;
+            } else if (flac) {
+                bindings.Feed(flac, value);
+                return;
+            }
+            signal();
+        }, err => {
+            error = err;
+            signal();
+        });
+    };
+    const message = (type, data) => {
+        switch (type) {
+        case Types.Data:
+            frames.push(data);
+            break;
+        case Types.Format:
+            if (options.onFormat)
+                options.onFormat(data);
+            break;
+        case Types.Done:
+            feed();
+            return;
+        case Types.End:
+            flac = undefined;
+            finished = true;
+            break;
+        }
+        signal();
+    };
+
+    // unbatched, a batch would join every granted chunk into one frame.
+    // feed() only runs on a Done, which needs the lockstep input of budget 0
+    flac = bindings.Open(message, Object.assign({}, options, { pull: true, batch: false, inputBudget: 0 }));
+    try {
+        bindings.Request(flac, prefetch);
+        feed();
+        for (;;) {
+            if (frames.length) {
+                const frame = frames.shift();
+                // the next one decodes while the consumer works on this one
+                if (flac)
+                    bindings.Request(flac, 1);
+                yield frame;
+            } else if (error) {
+                throw error;
+            } else if (finished) {
+                return;
+            } else {
+                await new Promise(resolve => { wake = resolve; });
+            }
+        }
+    } finally {
+        if (flac)
+            bindings.Close(flac);
+        flac = undefined;
+        if (typeof chunks.return === "function")
+            chunks.return();
+    }
+}
+
+// one source of a GaplessQueue: its decoder runs ahead and the pcm is held
+// here, trimmed to [start, end) sample frames, until the queue takes it
+class GaplessTrack {
+    constructor(source, options, decoderOptions, onChange, onError) {
+        this.source = source;
+        this.start = options.start || 0;
+        this.end = options.end;
+        this.position = 0;
+        this.chunks = [];
+        this.bytes = 0;
+        this.limit = 0;
+        this.format = undefined;
+        this.frameSize = 0;
+        this.ended = false;
+        // inputs opened here are closed here too
+        this.ownsInput = typeof source === "string" || Buffer.isBuffer(source);
+
+        if (typeof source === "string")
+            this.input = fs.createReadStream(source);
+        else if (Buffer.isBuffer(source))
+            this.input = Readable.from([source]);
+        else
+            this.input = source;
+        this.decoder = new FlacDecoder(decoderOptions);
+        this.decoder.on("format", format => {
+            this.format = format;
+            this.frameSize = format.channels * format.bitDepth / 8;
+            onChange();
+        });
+        this.decoder.on("readable", () => {
+            this.fill();
+            onChange();
+        });
+        this.decoder.on("end", () => {
+            this.ended = true;
+            onChange();
+        });
+        this.decoder.on("error", onError);
+        this.input.on("error", onError);
+        this.input.pipe(this.decoder);
+    }
+
+    get done() {
+        return this.ended && !this.chunks.length;
+    }
+
+    // pulls decoded pcm until limit bytes are held
+    fill() {
+        let chunk;
+        while (!this.ended && this.bytes < this.limit && (chunk = this.decoder.read()) !== null) {
+            chunk = this.trim(chunk);
+            if (chunk.length) {
+                this.chunks.push(chunk);
+                this.bytes += chunk.length;
+            }
+            if (this.end !== undefined && this.position >= this.end) {
+                // everything past end is dropped, no need to decode it
+                this.ended = true;
+                this.close();
+            }
+        }
+    }
+
+    take() {
+        const chunk = this.chunks.shift();
+        this.bytes -= chunk.length;
+        return chunk;
+    }
+
+    // chunks are whole sample frames, so the cut is sample exact
+    trim(chunk) {
+        const from = this.position;
+        const to = from + chunk.length / this.frameSize;
+        this.position = to;
+        const lo = Math.max(from, this.start);
+        const hi = this.end !== undefined ? Math.min(to, this.end) : to;
+        if (hi <= lo)
+            return chunk.subarray(0, 0);
+        if (lo === from && hi === to)
+            return chunk;
+        return chunk.subarray((lo - from) * this.frameSize, (hi - from) * this.frameSize);
+    }
+
+    close() {
+        this.input.unpipe(this.decoder);
+        if (this.ownsInput)
+            this.input.destroy();
+        this.decoder.destroy();
+    }
+}
+
+// plays sources back to back without a gap: while one source is being
+// read, the next one is already opened and its first options.preroll ms
+// (default 500) are decoded, so its pcm follows the last frame of the
+// current one directly. options.decoder are FlacDecoder options used for
+// every source, all sources should decode to the same format. emits
+// "format" for the first source and whenever the format changes, and
+// "track" with the source when playback moves on to the next one.
+//
+//   queue.enqueue(source, { start, end })
+//
+// source is a path, a Buffer or a readable stream. start and end, in
+// sample frames, trim the source, e.g. encoder delay and padding.
+// queue.end() marks the end of the list, the queue ends after the last
+// source.
+class GaplessQueue extends Readable {
+    constructor(options) {
+        options = options || {};
+        super({ highWaterMark: options.highWaterMark });
+        this._decoderOptions = options.decoder || {};
+        this._preroll = options.preroll !== undefined ? options.preroll : 500;
+        this._pending = [];
+        this._current = undefined;
+        this._next = undefined;
+        this._format = undefined;
+        this._wanted = false;
+        this._ending = false;
+    }
+
+    enqueue(source, options) {
+        if (this._ending)
+            throw new Error("enqueue after end");
+        this._pending.push({ source: source, options: options || {} });
+        this._schedule();
+        return this;
+    }
+
+    end() {
+        this._ending = true;
+        this._flow();
+        return this;
+    }
+
+    _open(entry) {
+        return new GaplessTrack(entry.source, entry.options, this._decoderOptions, () => {
+            this._schedule();
+            this._flow();
+        }, err => this.destroy(err));
+    }
+
+    _prerollBytes(track) {
+        // until the format shows up a read is still needed to notice a
+        // source ending without one, empty or not flac at all
+        if (!track.format)
+            return track.ended ? 0 : 1;
+        return Math.ceil(this._preroll * track.format.sampleRate / 1000) * track.frameSize;
+    }
+
+    _schedule() {
+        if (!this._current && this._pending.length)
+            this._current = this._open(this._pending.shift());
+        if (this._current && !this._next && this._pending.length)
+            this._next = this._open(this._pending.shift());
+        if (this._next) {
+            this._next.limit = this._prerollBytes(this._next);
+            this._next.fill();
+        }
+    }
+
+    _announce(format) {
+        const previous = this._format;
+        this._format = format;
+        if (!previous || previous.sampleRate !== format.sampleRate
+            || previous.channels !== format.channels || previous.bitDepth !== format.bitDepth)
+            this.emit("format", format);
+    }
+
+    _read() {
+        this._wanted = true;
+        this._flow();
+    }
+
+    _flow() {
+        while (this._wanted && this._current) {
+            const track = this._current;
+            if (track.done) {
+                // a source that ended without a format is skipped
+                this._current = this._next;
+                this._next = undefined;
+                this._schedule();
+                if (this._current)
+                    this.emit("track", this._current.source);
+                continue;
+            }
+            if (!track.format) {
+                track.limit = this._prerollBytes(track);
+                track.fill();
+                break;
+            }
+            if (this._format !== track.format)
+                this._announce(track.format);
+            if (track.chunks.length) {
+                this._wanted = this.push(track.take());
+                continue;
+            }
+            // keep a preroll's worth ahead of the reader
+            track.limit = Math.max(this._prerollBytes(track), 65536);
+            track.fill();
+            if (!track.chunks.length)
+                break;
+        }
+        if (this._wanted && !this._current && this._ending && !this._pending.length) {
+            this._wanted = false;
+            this.push(null);
+        }
+    }
+
+    _destroy(err, callback) {
+        for (const track of [this._current, this._next]) {
+            if (track)
+                track.close();
+        }
+        this._current = this._next = undefined;
+        this._pending = [];
+        callback(err);
+    }
+}
+
+const RingHeader = 64;
+const RingSlot = { Write: 0, Read: 1, Flags: 2, SampleRate: 3, Channels: 4, BitDepth: 5 };
+const RingEnded = 1;
+
+// a SharedArrayBuffer for the ring option of FlacDecoder, with room for at
+// least bytes of pcm. the data size is rounded up to a power of two
+function createRing(bytes) {
+    let capacity = 1024;
+    while (capacity < bytes)
+        capacity *= 2;
+    return new SharedArrayBuffer(RingHeader + capacity);
+}
+
+// the reading end of a ring (see src/ring.h for the layout). meant for an
+// audio thread or worker, nothing here touches the decoder or the main loop
+class RingReader {
+    constructor(ring) {
+        this._header = new Uint32Array(ring, 0, RingHeader / 4);
+        this._data = new Uint8Array(ring, RingHeader);
+        this._mask = this._data.length - 1;
+    }
+
+    // bytes ready to read
+    get available() {
+        return (Atomics.load(this._header, RingSlot.Write) - Atomics.load(this._header, RingSlot.Read)) >>> 0;
+    }
+
+    // the stream ended and everything was read
+    get ended() {
+        return (Atomics.load(this._header, RingSlot.Flags) & RingEnded) !== 0 && !this.available;
+    }
+
+    // the format of the pcm available to read, undefined before any. the
+    // decoder waits for the ring to drain before switching formats
+    get format() {
+        const bitDepth = Atomics.load(this._header, RingSlot.BitDepth);
+        if (!bitDepth)
+            return undefined;
+        return {
+            sampleRate: Atomics.load(this._header, RingSlot.SampleRate),
+            channels: Atomics.load(this._header, RingSlot.Channels),
+            bitDepth: bitDepth
+        };
+    }
+
+    // copies up to target.byteLength bytes into target (a typed array),
+    // returns the number of bytes copied
+    read(target) {
+        const dst = new Uint8Array(target.buffer, target.byteOffset, target.byteLength);
+        const rpos = Atomics.load(this._header, RingSlot.Read);
+        const size = Math.min(dst.length, this.available);
+        const offset = rpos & this._mask;
+        const first = Math.min(size, this._data.length - offset);
+        dst.set(this._data.subarray(offset, offset + first));
+        dst.set(this._data.subarray(0, size - first), first);
+        Atomics.store(this._header, RingSlot.Read, (rpos + size) >>> 0);
+        return size;
+    }
+}
+
+// FlacDecoder instances come out of a pool of warm decoders, each with its
+// own decoding thread. a stream that ends or is closed hands its decoder
+// back, up to size are kept (default 4) and 0 turns the pool off. the
+// addon can be loaded in worker_threads, each worker has its own pool and
+// its decoders deliver on that worker's loop. throws unless size is a
+// non-negative integer
+function setDecoderPoolSize(size) {
+    bindings.SetPoolSize(size);
+}
+
+const RateCounters = ["bytesFed", "bytesDecoded", "bytesOutput", "frames", "samples", "wakeups"];
+
+// process wide counters over all FlacDecoder streams, worker threads
+// included. pass the snapshot of an earlier call as previous to get rates,
+// the per second rates since then. each poller keeps its own previous, so
+// they don't skew each other. frameDecode is a histogram of the time to
+// decode one frame in seconds, cheap enough to poll every second
+function metrics(previous) {
+    const snapshot = bindings.Metrics();
+    if (previous && snapshot.uptime > previous.uptime) {
+        const seconds = snapshot.uptime - previous.uptime;
+        snapshot.rates = {};
+        for (const name of RateCounters)
+            snapshot.rates[name] = (snapshot[name] - previous[name]) / seconds;
+    }
+    return snapshot;
+}
+
+// metrics() in the prometheus text exposition format, for a scrape handler
+function prometheusMetrics(prefix) {
+    prefix = prefix || "flac";
+    const snapshot = bindings.Metrics();
+    const lines = [];
+    const metric = (name, type, help, value) => {
+        lines.push(`# HELP ${prefix}_${name} ${help}`, `# TYPE ${prefix}_${name} ${type}`, `${prefix}_${name} ${value}`);
+    };
+    metric("open_decoders", "gauge", "Decoders attached to a stream.", snapshot.openDecoders);
+    metric("decoder_threads", "gauge", "Decoder threads alive, pooled ones included.", snapshot.decoderThreads);
+    metric("active_threads", "gauge", "Decoder threads decoding a stream.", snapshot.activeThreads);
+    metric("streams_total", "counter", "Streams opened.", snapshot.streams);
+    metric("fed_bytes_total", "counter", "Input bytes fed to decoders.", snapshot.bytesFed);
+    metric("decoded_bytes_total", "counter", "Input bytes consumed by decoders.", snapshot.bytesDecoded);
+    metric("output_bytes_total", "counter", "Pcm bytes produced.", snapshot.bytesOutput);
+    metric("frames_total", "counter", "Frames decoded.", snapshot.frames);
+    metric("samples_total", "counter", "Samples per channel decoded.", snapshot.samples);
+    metric("wakeups_total", "counter", "Decoder message deliveries on the js thread.", snapshot.wakeups);
+
+    const hist = snapshot.frameDecode;
+    const name = `${prefix}_frame_decode_seconds`;
+    lines.push(`# HELP ${name} Time to decode one frame.`, `# TYPE ${name} histogram`);
+    let cumulative = 0;
+    hist.bounds.forEach((bound, i) => {
+        cumulative += hist.counts[i];
+        lines.push(`${name}_bucket{le="${bound}"} ${cumulative}`);
+    });
+    lines.push(`${name}_bucket{le="+Inf"} ${hist.count}`, `${name}_sum ${hist.sum}`, `${name}_count ${hist.count}`);
+    return lines.join("\n") + "\n";
+}
+
+// the chrome trace event json of one or more FlacDecoder traces, for
+// perfetto or chrome://tracing
+function chromeTrace(traces) {
+    const events = [].concat(traces).reduce((all, trace) => all.concat(trace.traceEvents), []);
+    return JSON.stringify({ traceEvents: events, displayTimeUnit: "ms" });
+}
+
+// decodes source (a path or a Buffer holding a whole flac file) on the libuv
+// thread pool and runs the requested analyzers over it. no pcm is handed to
+// js. many calls in parallel spread over the pool (see UV_THREADPOOL_SIZE).
+//
+// analyzers, as keys of options:
+//   peaks:    { bucketsPerSecond }, see computePeaks
+//   loudness: true or { series }, EBU R128 integrated/momentary/short-term
+//             loudness in LUFS, loudness range in LU and true peak in dBTP.
+//             series adds momentary and short-term values every 100ms
+//   silence:  true or { threshold, minDuration }, leading and trailing
+//             silence and the gaps [{ start, end }] in between, in samples.
+//             a sample is silent when no channel exceeds threshold (dBFS,
+//             default -60), gaps shorter than minDuration (seconds, default
+//             0.5) are ignored
+//   fingerprint: true, see fingerprint
+//   hash:     true, "xxh64" (the default) or "blake3", a hash of the decoded
+//             audio as { algorithm, digest, samples }. the bytes hashed are
+//             the ones the STREAMINFO md5 covers, so it doesn't depend on
+//             the encoder settings or on the metadata
+//   spectrogram: true or { fftSize, hop, window, format, floor }, see
+//             spectrogram, computed over the whole range in one go
+//   transcode: true, see detectTranscode
+//   verify:   true, see verify
+//
+// range: { start, end } only decodes those samples, seeking to start. an
+// empty range only reads the stream info
+function analyze(source, options) {
+    return new Promise((resolve, reject) => {
+        bindings.Analyze(source, options || {}, (err, result) => {
+            if (err)
+                reject(err);
+            else
+                resolve(result);
+        });
+    });
+}
+
+// per channel min/max/rms Float32Arrays, bucketsPerSecond defaults to 100
+function computePeaks(source, options) {
+    return analyze(source, { peaks: options || {} }).then(result => result.peaks);
+}
+
+// decodes with libFLAC's md5 checking on and resolves with
+// { ok, md5, samples, errors: [{ status, sample, byte }] }. md5 is "match",
+// "mismatch" or "unchecked" when the encoder left the STREAMINFO md5 unset.
+// a stream that can't be decoded at all resolves with ok false and error.
+function verify(source) {
+    return analyze(source, { verify: true }).then(result => result.verify);
+}
+
+// acoustic fingerprint, resolves with { frameRate, duration, fingerprint }
+// where fingerprint is a Uint32Array of one word per frame
+function fingerprint(source) {
+    return analyze(source, { fingerprint: true }).then(result => result.fingerprint);
+}
+
+function popcount(v) {
+    v = v - ((v >>> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >>> 2) & 0x33333333);
+    return (((v + (v >>> 4)) & 0x0f0f0f0f) * 0x01010101) >>> 24;
+}
+
+// compares two fingerprints (the Uint32Arrays or the fingerprint results)
+// at every offset up to options.maxOffset frames (default 80, about 10s)
+// and returns { score, offset }. score is the share of matching bits at the
+// best offset, around 0.5 for unrelated audio and close to 1 for the same
+// recording. offset is the frame of a that the start of b lines up with
+function compareFingerprints(a, b, options) {
+    a = a.fingerprint || a;
+    b = b.fingerprint || b;
+    const maxOffset = (options && options.maxOffset !== undefined) ? options.maxOffset : 80;
+    const minOverlap = Math.max(1, Math.min(a.length, b.length) >> 1);
+    let best = { score: 0, offset: 0 };
+    for (let offset = -maxOffset; offset <= maxOffset; ++offset) {
+        const start = Math.max(0, offset);
+        const end = Math.min(a.length, b.length + offset);
+        if (end - start < minOverlap)
+            continue;
+        let bits = 0;
+        for (let i = start; i < end; ++i)
+            bits += popcount(a[i] ^ b[i - offset]);
+        const score = 1 - bits / ((end - start) * 32);
+        if (score > best.score)
+            best = { score: score, offset: offset };
+    }
+    return best;
+}
+
+// content hash of the decoded audio, resolves with the hex digest
+function contentHash(source, algorithm) {
+    return analyze(source, { hash: algorithm || true }).then(result => result.hash.digest);
+}
+
+// short-time magnitude spectrum of the channels mixed to mono, in dBFS.
+// the stream is split into tiles of options.tileFrames frames (default 2048)
+// that are decoded and transformed in parallel, options.concurrency (default
+// the pool size) at a time. other options:
+//   fftSize: power of two, default 2048
+//   hop:     samples between frames, default fftSize / 4
+//   window:  "hann" (default), "hamming", "blackman" or "rectangular"
+//   format:  "float32" (default) or "uint8", which maps floor .. 0 dB to
+//            0 .. 255
+//   floor:   lowest level in dB, default -120
+// resolves with { sampleRate, fftSize, hop, bins, frames, format, floor,
+// tiles: [{ frame, frames, data }] }, data holding frames rows of bins values
+function spectrogram(source, options) {
+    options = options || {};
+    const fftSize = options.fftSize || 2048;
+    const hop = options.hop || fftSize >> 2;
+    const tileFrames = options.tileFrames || 2048;
+    const concurrency = options.concurrency || defaultConcurrency();
+    const stft = { fftSize: fftSize, hop: hop, window: options.window, format: options.format, floor: options.floor };
+    const assemble = (info, results) => {
+        const first = results[0].spectrogram;
+        const out = {
+            sampleRate: info.sampleRate,
+            fftSize: first.fftSize,
+            hop: first.hop,
+            bins: first.bins,
+            frames: 0,
+            format: first.format,
+            floor: first.floor,
+            tiles: []
+        };
+        for (const result of results) {
+            out.tiles.push({ frame: out.frames, frames: result.spectrogram.frames, data: result.spectrogram.data });
+            out.frames += result.spectrogram.frames;
+        }
+        return out;
+    };
+
+    return analyze(source, { range: { start: 0, end: 0 } }).then(info => {
+        const total = info.totalSamples;
+        if (!total) {
+            // no length in the stream info, no way to split it up
+            return analyze(source, { spectrogram: stft }).then(result => assemble(info, [result]));
+        }
+        const frames = Math.ceil(total / hop);
+        const jobs = [];
+        for (let frame = 0; frame < frames; frame += tileFrames)
+            jobs.push({ frame: frame, frames: Math.min(tileFrames, frames - frame) });
+        return mapLimited(jobs, concurrency, job => {
+            const start = job.frame * hop;
+            const end = Math.min(total, (job.frame + job.frames - 1) * hop + fftSize);
+            return analyze(source, {
+                range: { start: start, end: end },
+                spectrogram: Object.assign({}, stft, { frames: job.frames })
+            });
+        }).then(results => assemble(info, results));
+    });
+}
+
+// looks for signs of a lossy source (mp3, aac, ...) re-encoded as flac: the
+// encoder's lowpass in the long-term spectrum. resolves with { score,
+// cutoff, drop, steepness }: score from 0 (no lowpass found) to 1 (a steep
+// cutoff, very likely a transcode), cutoff in Hz, drop in dB across the
+// cutoff and steepness in dB per kHz. material that simply has no high
+// frequencies can score too, the score is a hint, not a verdict
+function detectTranscode(source) {
+    return analyze(source, { transcode: true }).then(result => result.transcode);
+}
+
+// detectTranscode over a list of sources, at most options.concurrency at a
+// time. sources that fail to decode get { error } instead
+function detectTranscodeMany(sources, options) {
+    const concurrency = (options && options.concurrency) || defaultConcurrency();
+    return mapLimited(sources, concurrency, source => detectTranscode(source).catch(err => {
+        return { error: err.message };
+    }));
+}
+
+// runs fn over items with at most concurrency calls in flight, results in order
+function mapLimited(items, concurrency, fn) {
+    const results = new Array(items.length);
+    let next = 0;
+    const worker = () => {
+        if (next >= items.length)
+            return Promise.resolve();
+        const idx = next++;
+        return fn(items[idx], idx).then(result => {
+            results[idx] = result;
+            return worker();
+        });
+    };
+    const workers = [];
+    for (let i = 0; i < Math.min(concurrency, items.length); ++i)
+        workers.push(worker());
+    return Promise.all(workers).then(() => results);
+}
+
+function defaultConcurrency() {
+    return parseInt(process.env.UV_THREADPOOL_SIZE, 10) || 4;
+}
+
+// verifies a list of sources on the thread pool, keeping at most
+// options.concurrency (default: the pool size) files queued at a time
+function verifyMany(sources, options) {
+    const concurrency = (options && options.concurrency) || defaultConcurrency();
+    return mapLimited(sources, concurrency, source => verify(source).catch(err => {
+        return { ok: false, md5: "unchecked", samples: 0, errors: [], error: err.message };
+    }));
+}
+
+// decodes a whole source (a path or a Buffer) to pcm on the thread pool.
+// options are the FlacDecoder ones (packed24, resample, channelMap, matrix,
+// downmix, gain, analyze, output). resolves with { sampleRate, channels,
+// bitDepth, totalSamples, samples, format, data, analysis }, format and
+// data being the interleaved output and analysis the analyzer results
+function decodeFile(source, options) {
+    return new Promise((resolve, reject) => {
+        bindings.DecodeFile(source, options || {}, (err, result) => {
+            if (err)
+                reject(err);
+            else
+                resolve(result);
+        });
+    });
+}
+
+// decodes a list of sources with decodeFile, at most options.concurrency
+// (default the pool size) at a time, and calls onResult(err, result, source,
+// index) for each in completion order. memory is bounded by
+// options.maxInFlightBytes (default 256MB): before a decode starts its pcm
+// size is estimated from the stream info and reserved, and a decode only
+// starts while the reservations plus the pcm handed to onResult and not yet
+// released fit. a result counts until the promise onResult returns settles. resolves with the aggregate { files,
+// failed, inputBytes, outputBytes, audioSeconds, seconds, realtime,
+// mbPerSecond } once everything is done
+function decodeMany(sources, options, onResult) {
+    if (typeof options === "function") {
+        onResult = options;
+        options = {};
+    }
+    options = options || {};
+    const concurrency = options.concurrency || defaultConcurrency();
+    const maxInFlight = options.maxInFlightBytes || 256 * 1048576;
+    const decodeOptions = Object.assign({}, options);
+    delete decodeOptions.concurrency;
+    delete decodeOptions.maxInFlightBytes;
+
+    const stats = { files: 0, failed: 0, inputBytes: 0, outputBytes: 0, audioSeconds: 0 };
+    let inFlight = 0;
+    const waiting = [];
+    // a decode only starts once its estimated output fits, or when nothing
+    // else is in flight so an oversized file can't stall the batch
+    const fits = bytes => !inFlight || inFlight + bytes <= maxInFlight;
+    const admit = bytes => {
+        if (!waiting.length && fits(bytes)) {
+            inFlight += bytes;
+            return Promise.resolve();
+        }
+        return new Promise(resolve => waiting.push({ bytes: bytes, resolve: resolve }));
+    };
+    const release = bytes => {
+        inFlight -= bytes;
+        while (waiting.length && fits(waiting[0].bytes)) {
+            const next = waiting.shift();
+            inFlight += next.bytes;
+            next.resolve();
+        }
+    };
+    const inputSize = source => {
+        if (typeof source !== "string")
+            return Promise.resolve(source.length);
+        return fs.promises.stat(source).then(st => st.size, () => 0);
+    };
+    // an upper bound of the pcm a source decodes to, from its stream info.
+    // samples are counted at 4 bytes and resampling up scales it. without a
+    // length in the stream info the input size stands in, flac rarely gets
+    // below 1/8th of the pcm
+    const estimate = (source, size) => {
+        if (decodeOptions.output === false)
+            return Promise.resolve(0);
+        return analyze(source, { range: { start: 0, end: 0 } }).then(info => {
+            if (!info.totalSamples || !info.sampleRate)
+                return size * 8;
+            const resample = decodeOptions.resample;
+            const rate = resample && resample.sampleRate ? Math.max(1, resample.sampleRate / info.sampleRate) : 1;
+            const channels = Math.max(info.channels, (decodeOptions.channelMap || []).length,
+                                      (decodeOptions.matrix || []).length);
+            return Math.ceil(info.totalSamples * rate) * channels * 4;
+        }, () => size * 8);
+    };
+
+    const start = process.hrtime.bigint();
+    return mapLimited(sources, concurrency, (source, idx) => {
+        let reserved = 0, size = 0;
+        return inputSize(source).then(bytes => {
+            size = bytes;
+            return estimate(source, size);
+        }).then(bytes => {
+            reserved = bytes;
+            return admit(reserved);
+        }).then(() => decodeFile(source, decodeOptions)).then(result => {
+            const bytes = result.data ? result.data.length : 0;
+            ++stats.files;
+            stats.inputBytes += size;
+            stats.outputBytes += bytes;
+            if (result.sampleRate)
+                stats.audioSeconds += result.samples / result.sampleRate;
+            // the estimate is an upper bound, hand back what wasn't used
+            release(reserved - bytes);
+            return Promise.resolve(onResult(null, result, source, idx)).then(() => release(bytes), err => {
+                release(bytes);
+                throw err;
+            });
+        }, err => {
+            release(reserved);
+            ++stats.failed;
+            return onResult(err, undefined, source, idx);
+        });
+    }).then(() => {
+        stats.seconds = Number(process.hrtime.bigint() - start) / 1e9;
+        stats.realtime = stats.seconds ? stats.audioSeconds / stats.seconds : 0;
+        stats.mbPerSecond = stats.seconds ? stats.inputBytes / 1048576 / stats.seconds : 0;
+        return stats;
+    });
+}
+
+// fingerprints a list of sources, at most options.concurrency at a time.
+// a source that fails gives { error } instead of failing the whole batch
+function fingerprintMany(sources, options) {
+    const concurrency = (options && options.concurrency) || defaultConcurrency();
+    return mapLimited(sources, concurrency, source => fingerprint(source).catch(err => {
+        return { error: err.message };
+    }));
+}
+
+module.exports = {
+    FlacDecoder: FlacDecoder,
+    GaplessQueue: GaplessQueue,
+    decodeFrames: decodeFrames,
+    RingReader: RingReader,
+    createRing: createRing,
+    setDecoderPoolSize: setDecoderPoolSize,
+    metrics: metrics,
+    prometheusMetrics: prometheusMetrics,
+    chromeTrace: chromeTrace,
+    analyze: analyze,
+    decodeFile: decodeFile,
+    decodeMany: decodeMany,
+    computePeaks: computePeaks,
+    contentHash: contentHash,
+    spectrogram: spectrogram,
+    fingerprint: fingerprint,
+    fingerprintMany: fingerprintMany,
+    compareFingerprints: compareFingerprints,
+    detectTranscode: detectTranscode,
+    detectTranscodeMany: detectTranscodeMany,
+    verify: verify,
+    verifyMany: verifyMany
+};
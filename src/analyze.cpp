@@ -0,0 +1,361 @@
+#include "analyze.h"
+#include "contenthash.h"
+#include "fingerprint.h"
+#include "loudness.h"
+#include "peaks.h"
+#include "silence.h"
+#include "spectrogram.h"
+#include "transcode.h"
+
+class AnalyzeWorker : public Nan::AsyncWorker
+{
+public:
+    AnalyzeWorker(Nan::Callback* callback, const FileDecoder::Source& source, bool verifying)
+        : Nan::AsyncWorker(callback, "flac:Analyze"), decoder(source), verify(verifying), failed(false)
+    {
+        decoder.setMd5Checking(verify);
+    }
+
+    FileDecoder decoder;
+
+    void Execute() override
+    {
+        if (!decoder.run()) {
+            // a broken stream is a verification result, not an error
+            if (verify) {
+                failed = true;
+            } else {
+                SetErrorMessage(decoder.error().c_str());
+            }
+        }
+    }
+
+    v8::Local<v8::Value> verifyResult() const
+    {
+        Nan::EscapableHandleScope scope;
+        v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+        const auto& errors = decoder.decodeErrors();
+        const FileDecoder::Md5 md5 = decoder.md5();
+        const bool ok = !failed && errors.empty() && md5 != FileDecoder::Md5::Mismatch;
+        const char* md5Name = md5 == FileDecoder::Md5::Match ? "match"
+            : md5 == FileDecoder::Md5::Mismatch ? "mismatch" : "unchecked";
+        Nan::Set(obj, Nan::New("ok").ToLocalChecked(), Nan::New<v8::Boolean>(ok));
+        Nan::Set(obj, Nan::New("md5").ToLocalChecked(), Nan::New(md5Name).ToLocalChecked());
+        Nan::Set(obj, Nan::New("samples").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(decoder.samplesDecoded())));
+        v8::Local<v8::Array> list = Nan::New<v8::Array>(errors.size());
+        for (size_t i = 0; i < errors.size(); ++i) {
+            v8::Local<v8::Object> err = Nan::New<v8::Object>();
+            Nan::Set(err, Nan::New("status").ToLocalChecked(), Nan::New(errors[i].status).ToLocalChecked());
+            Nan::Set(err, Nan::New("sample").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(errors[i].sample)));
+            if (errors[i].byte != UINT64_MAX)
+                Nan::Set(err, Nan::New("byte").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(errors[i].byte)));
+            Nan::Set(list, i, err);
+        }
+        Nan::Set(obj, Nan::New("errors").ToLocalChecked(), list);
+        if (failed)
+            Nan::Set(obj, Nan::New("error").ToLocalChecked(), Nan::New(decoder.error()).ToLocalChecked());
+        return scope.Escape(obj);
+    }
+
+    void HandleOKCallback() override
+    {
+        Nan::HandleScope scope;
+        const auto& info = decoder.info();
+        v8::Local<v8::Object> result = Nan::New<v8::Object>();
+        Nan::Set(result, Nan::New("sampleRate").ToLocalChecked(), Nan::New<v8::Number>(info.sampleRate));
+        Nan::Set(result, Nan::New("channels").ToLocalChecked(), Nan::New<v8::Number>(info.channels));
+        Nan::Set(result, Nan::New("bitDepth").ToLocalChecked(), Nan::New<v8::Number>(info.bitsPerSample));
+        Nan::Set(result, Nan::New("totalSamples").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(info.totalSamples)));
+        if (!failed) {
+            for (const auto& analyzer : decoder.getAnalyzers()) {
+                Nan::Set(result, Nan::New(analyzer->name()).ToLocalChecked(), analyzer->result());
+            }
+        }
+        if (verify)
+            Nan::Set(result, Nan::New("verify").ToLocalChecked(), verifyResult());
+
+        v8::Local<v8::Value> argv[] = { Nan::Null(), result };
+        callback->Call(2, argv, async_resource);
+    }
+
+private:
+    bool verify, failed;
+};
+
+static v8::Local<v8::Value> getOption(v8::Local<v8::Object> obj, const char* name)
+{
+    v8::Local<v8::Value> v;
+    if (!Nan::Get(obj, Nan::New(name).ToLocalChecked()).ToLocal(&v))
+        return Nan::Undefined();
+    return v;
+}
+
+bool createAnalyzers(v8::Local<v8::Value> value, std::vector<std::unique_ptr<Analyzer> >& analyzers)
+{
+    if (!value->IsObject())
+        return true;
+    v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(value);
+
+    v8::Local<v8::Value> peaks = getOption(options, "peaks");
+    if (peaks->IsObject() || peaks->IsTrue()) {
+        double bucketsPerSecond = 100.;
+        if (peaks->IsObject()) {
+            v8::Local<v8::Value> v = getOption(v8::Local<v8::Object>::Cast(peaks), "bucketsPerSecond");
+            if (!v->IsUndefined())
+                bucketsPerSecond = Nan::To<double>(v).FromMaybe(0.);
+        }
+        if (!(bucketsPerSecond > 0.)) {
+            Nan::ThrowError("bucketsPerSecond must be positive");
+            return false;
+        }
+        analyzers.push_back(std::make_unique<PeaksAnalyzer>(bucketsPerSecond));
+    }
+
+    v8::Local<v8::Value> loudness = getOption(options, "loudness");
+    if (loudness->IsObject() || loudness->IsTrue()) {
+        bool series = false;
+        if (loudness->IsObject())
+            series = Nan::To<bool>(getOption(v8::Local<v8::Object>::Cast(loudness), "series")).FromMaybe(false);
+        analyzers.push_back(std::make_unique<LoudnessAnalyzer>(series));
+    }
+
+    v8::Local<v8::Value> hash = getOption(options, "hash");
+    if (hash->IsString() || hash->IsTrue()) {
+        Hash::Algorithm algorithm = Hash::Algorithm::Xxh64;
+        if (hash->IsString() && !Hash::parseAlgorithm(*Nan::Utf8String(hash), &algorithm)) {
+            Nan::ThrowError("Unknown hash algorithm");
+            return false;
+        }
+        analyzers.push_back(std::make_unique<ContentHashAnalyzer>(algorithm));
+    }
+
+    if (getOption(options, "fingerprint")->IsTrue())
+        analyzers.push_back(std::make_unique<FingerprintAnalyzer>());
+
+    if (getOption(options, "transcode")->IsTrue())
+        analyzers.push_back(std::make_unique<TranscodeAnalyzer>());
+
+    v8::Local<v8::Value> silence = getOption(options, "silence");
+    if (silence->IsObject() || silence->IsTrue()) {
+        double threshold = -60., minDuration = 0.5;
+        if (silence->IsObject()) {
+            v8::Local<v8::Object> obj = v8::Local<v8::Object>::Cast(silence);
+            v8::Local<v8::Value> v = getOption(obj, "threshold");
+            if (!v->IsUndefined())
+                threshold = Nan::To<double>(v).FromMaybe(1.);
+            v = getOption(obj, "minDuration");
+            if (!v->IsUndefined())
+                minDuration = Nan::To<double>(v).FromMaybe(-1.);
+        }
+        if (!(threshold <= 0.)) {
+            Nan::ThrowError("silence threshold must be at most 0 dBFS");
+            return false;
+        }
+        if (!(minDuration >= 0.)) {
+            Nan::ThrowError("silence minDuration can't be negative");
+            return false;
+        }
+        analyzers.push_back(std::make_unique<SilenceAnalyzer>(threshold, minDuration));
+    }
+
+    v8::Local<v8::Value> spectrogram = getOption(options, "spectrogram");
+    if (spectrogram->IsObject() || spectrogram->IsTrue()) {
+        SpectrogramAnalyzer::Options opts;
+        bool hop = false;
+        if (spectrogram->IsObject()) {
+            v8::Local<v8::Object> obj = v8::Local<v8::Object>::Cast(spectrogram);
+            v8::Local<v8::Value> v = getOption(obj, "fftSize");
+            if (!v->IsUndefined()) {
+                opts.fftSize = Nan::To<uint32_t>(v).FromMaybe(0);
+                if (opts.fftSize < 16 || opts.fftSize > 65536 || (opts.fftSize & (opts.fftSize - 1))) {
+                    Nan::ThrowError("fftSize must be a power of two from 16 to 65536");
+                    return false;
+                }
+            }
+            v = getOption(obj, "hop");
+            if (!v->IsUndefined()) {
+                opts.hop = Nan::To<uint32_t>(v).FromMaybe(0);
+                if (!opts.hop) {
+                    Nan::ThrowError("hop must be positive");
+                    return false;
+                }
+                hop = true;
+            }
+            v = getOption(obj, "window");
+            if (!v->IsUndefined() && !Fft::parseWindow(*Nan::Utf8String(v), &opts.window)) {
+                Nan::ThrowError("Unknown window");
+                return false;
+            }
+            v = getOption(obj, "format");
+            if (!v->IsUndefined()) {
+                const std::string format = *Nan::Utf8String(v);
+                if (format != "float32" && format != "uint8") {
+                    Nan::ThrowError("format must be float32 or uint8");
+                    return false;
+                }
+                opts.quantize = format == "uint8";
+            }
+            v = getOption(obj, "floor");
+            if (!v->IsUndefined()) {
+                opts.floor = Nan::To<double>(v).FromMaybe(0.);
+                if (!(opts.floor < 0.)) {
+                    Nan::ThrowError("floor must be below 0 dB");
+                    return false;
+                }
+            }
+            v = getOption(obj, "frames");
+            if (!v->IsUndefined())
+                opts.frames = static_cast<uint64_t>(std::max(0., Nan::To<double>(v).FromMaybe(0.)));
+        }
+        if (!hop)
+            opts.hop = opts.fftSize / 4;
+        analyzers.push_back(std::make_unique<SpectrogramAnalyzer>(opts));
+    }
+    return true;
+}
+
+bool parseProcessorOptions(v8::Local<v8::Object> obj, Processor::Options* options)
+{
+    options->packed24 = Nan::To<bool>(getOption(obj, "packed24")).FromMaybe(false);
+
+    v8::Local<v8::Value> resample = getOption(obj, "resample");
+    if (resample->IsObject()) {
+        v8::Local<v8::Object> robj = v8::Local<v8::Object>::Cast(resample);
+        options->sampleRate = Nan::To<uint32_t>(getOption(robj, "sampleRate")).FromMaybe(0);
+        v8::Local<v8::Value> quality = getOption(robj, "quality");
+        if (quality->IsString()
+            && !Resampler::parseQuality(*Nan::Utf8String(quality), &options->quality)) {
+            Nan::ThrowError("Unknown resampler quality");
+            return false;
+        }
+    }
+
+    Mixer::Options& mixing = options->mixing;
+    v8::Local<v8::Value> channelMap = getOption(obj, "channelMap");
+    if (channelMap->IsArray()) {
+        v8::Local<v8::Array> arr = v8::Local<v8::Array>::Cast(channelMap);
+        if (arr->Length() == 0 || arr->Length() > FLAC__MAX_CHANNELS) {
+            Nan::ThrowError("channelMap needs 1 to 8 entries");
+            return false;
+        }
+        for (uint32_t i = 0; i < arr->Length(); ++i) {
+            mixing.channelMap.push_back(Nan::To<uint32_t>(Nan::Get(arr, i).ToLocalChecked()).FromMaybe(0));
+        }
+    }
+    v8::Local<v8::Value> matrix = getOption(obj, "matrix");
+    if (matrix->IsArray()) {
+        v8::Local<v8::Array> rows = v8::Local<v8::Array>::Cast(matrix);
+        if (rows->Length() == 0 || rows->Length() > FLAC__MAX_CHANNELS) {
+            Nan::ThrowError("matrix needs 1 to 8 rows");
+            return false;
+        }
+        for (uint32_t i = 0; i < rows->Length(); ++i) {
+            v8::Local<v8::Value> row = Nan::Get(rows, i).ToLocalChecked();
+            if (!row->IsArray()) {
+                Nan::ThrowError("matrix rows must be arrays");
+                return false;
+            }
+            v8::Local<v8::Array> cols = v8::Local<v8::Array>::Cast(row);
+            mixing.matrix.push_back(std::vector<float>());
+            for (uint32_t j = 0; j < cols->Length(); ++j) {
+                mixing.matrix.back().push_back(Nan::To<double>(Nan::Get(cols, j).ToLocalChecked()).FromMaybe(0));
+            }
+        }
+    }
+    ReplayGain::Options& gain = options->gain;
+    v8::Local<v8::Value> gainValue = getOption(obj, "gain");
+    v8::Local<v8::Value> mode = gainValue;
+    if (gainValue->IsNumber()) {
+        gain.fixed = true;
+        gain.db = Nan::To<double>(gainValue).FromJust();
+    } else if (gainValue->IsObject()) {
+        v8::Local<v8::Object> gobj = v8::Local<v8::Object>::Cast(gainValue);
+        v8::Local<v8::Value> db = getOption(gobj, "db");
+        if (db->IsNumber()) {
+            gain.fixed = true;
+            gain.db = Nan::To<double>(db).FromJust();
+        }
+        gain.preamp = Nan::To<double>(getOption(gobj, "preamp")).FromMaybe(0.);
+        v8::Local<v8::Value> preventClipping = getOption(gobj, "preventClipping");
+        if (!preventClipping->IsUndefined())
+            gain.preventClipping = Nan::To<bool>(preventClipping).FromMaybe(true);
+        mode = getOption(gobj, "mode");
+    }
+    if (mode->IsString() && !ReplayGain::parseMode(*Nan::Utf8String(mode), &gain.mode)) {
+        Nan::ThrowError("Unknown gain mode");
+        return false;
+    }
+
+    v8::Local<v8::Value> downmix = getOption(obj, "downmix");
+    if (downmix->IsString() && !Mixer::parseDownmix(*Nan::Utf8String(downmix), &mixing.downmix)) {
+        Nan::ThrowError("Unknown downmix");
+        return false;
+    }
+    return true;
+}
+
+bool parseSource(v8::Local<v8::Value> value, FileDecoder::Source* source)
+{
+    if (value->IsString()) {
+        source->path = *Nan::Utf8String(value);
+        return true;
+    }
+    if (node::Buffer::HasInstance(value)) {
+        source->data = reinterpret_cast<const unsigned char*>(node::Buffer::Data(value));
+        source->size = node::Buffer::Length(value);
+        return true;
+    }
+    Nan::ThrowError("Source must be a path or a Buffer");
+    return false;
+}
+
+NAN_METHOD(Analyze) {
+    if (!info[2]->IsFunction()) {
+        Nan::ThrowError("Argument must be a function");
+        return;
+    }
+
+    FileDecoder::Source source;
+    if (!parseSource(info[0], &source))
+        return;
+
+    std::vector<std::unique_ptr<Analyzer> > analyzers;
+    if (!createAnalyzers(info[1], analyzers))
+        return;
+
+    bool verify = false;
+    bool ranged = false;
+    uint64_t start = 0, end = UINT64_MAX;
+    if (info[1]->IsObject()) {
+        v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[1]);
+        verify = Nan::To<bool>(getOption(options, "verify")).FromMaybe(false);
+        v8::Local<v8::Value> range = getOption(options, "range");
+        if (range->IsObject()) {
+            v8::Local<v8::Value> v = getOption(v8::Local<v8::Object>::Cast(range), "start");
+            const double s = v->IsUndefined() ? 0. : Nan::To<double>(v).FromMaybe(-1.);
+            v = getOption(v8::Local<v8::Object>::Cast(range), "end");
+            const double e = v->IsUndefined() ? -1. : Nan::To<double>(v).FromMaybe(-1.);
+            if (!(s >= 0.) || (!v->IsUndefined() && !(e >= s))) {
+                Nan::ThrowError("Invalid range");
+                return;
+            }
+            ranged = true;
+            start = static_cast<uint64_t>(s);
+            if (!v->IsUndefined())
+                end = static_cast<uint64_t>(e);
+        }
+    }
+    if (verify && ranged) {
+        Nan::ThrowError("verify needs the whole stream, it can't be combined with range");
+        return;
+    }
+
+    AnalyzeWorker* worker = new AnalyzeWorker(new Nan::Callback(v8::Local<v8::Function>::Cast(info[2])), source, verify);
+    if (ranged)
+        worker->decoder.setRange(start, end);
+    for (auto& analyzer : analyzers)
+        worker->decoder.addAnalyzer(std::move(analyzer));
+    if (source.data)
+        worker->SaveToPersistent("source", info[0]);
+    Nan::AsyncQueueWorker(worker);
+}
@@ -0,0 +1,24 @@
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include <nan.h>
+#include "analyzer.h"
+#include "filedecoder.h"
+#include "processor.h"
+#include <memory>
+#include <vector>
+
+// builds the analyzers requested by the keys of an options object, throws
+// and returns false on bad options
+bool createAnalyzers(v8::Local<v8::Value> options, std::vector<std::unique_ptr<Analyzer> >& analyzers);
+
+// the output processing keys shared by FlacDecoder and the file decoders:
+// packed24, resample, channelMap, matrix, gain and downmix
+bool parseProcessorOptions(v8::Local<v8::Object> options, Processor::Options* processing);
+
+// a path string or a Buffer, the Buffer has to be kept alive by the caller
+bool parseSource(v8::Local<v8::Value> value, FileDecoder::Source* source);
+
+NAN_METHOD(Analyze);
+
+#endif
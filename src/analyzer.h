@@ -0,0 +1,45 @@
+#ifndef ANALYZER_H
+#define ANALYZER_H
+
+#include <nan.h>
+#include <FLAC/stream_decoder.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// consumes the planar decoder output of a stream, either as a side tap on
+// a regular decode or from a FileDecoder that produces no pcm at all.
+// format, process and finish run on the decoding thread, result on the
+// js thread once decoding is over.
+class Analyzer
+{
+public:
+    virtual ~Analyzer() {}
+
+    // property name of the result
+    virtual const char* name() const = 0;
+
+    virtual void format(uint32_t sampleRate, uint32_t channels, uint32_t bitsPerSample) = 0;
+    virtual void process(const FLAC__int32* const buffer[], unsigned samples) = 0;
+    virtual void finish() {}
+
+    virtual v8::Local<v8::Value> result() const = 0;
+};
+
+template<typename T, typename Array>
+inline v8::Local<Array> toTypedArray(const std::vector<T>& values)
+{
+    const size_t bytes = values.size() * sizeof(T);
+    // a fresh buffer is never pooled, so the data starts at offset 0
+    v8::Local<v8::Object> buffer = Nan::NewBuffer(bytes).ToLocalChecked();
+    if (bytes)
+        memcpy(node::Buffer::Data(buffer), values.data(), bytes);
+    return Array::New(v8::Local<v8::Uint8Array>::Cast(buffer)->Buffer(), 0, values.size());
+}
+
+inline v8::Local<v8::Float32Array> toFloat32Array(const std::vector<float>& values)
+{
+    return toTypedArray<float, v8::Float32Array>(values);
+}
+
+#endif
@@ -0,0 +1,43 @@
+#include "contenthash.h"
+#include "pack.h"
+
+ContentHashAnalyzer::ContentHashAnalyzer(Hash::Algorithm alg)
+    : algorithm(alg), hash(Hash::create(alg)), channels(0), bitsPerSample(0), samples(0)
+{
+}
+
+void ContentHashAnalyzer::format(uint32_t /*sampleRate*/, uint32_t count, uint32_t bits)
+{
+    // the hash runs on over format changes, like the bytes would in a file
+    channels = count;
+    bitsPerSample = bits;
+}
+
+void ContentHashAnalyzer::process(const FLAC__int32* const buffer[], unsigned count)
+{
+    const unsigned width = (bitsPerSample + 7) / 8;
+    bytes.resize(static_cast<size_t>(count) * channels * width);
+    if (bitsPerSample % 8 == 0) {
+        packSamples(bytes.data(), buffer, channels, count, bitsPerSample, true);
+    } else {
+        unsigned char* ptr = bytes.data();
+        for (unsigned i = 0; i < count; ++i) {
+            for (uint32_t c = 0; c < channels; ++c) {
+                for (unsigned b = 0; b < width; ++b)
+                    *(ptr++) = buffer[c][i] >> (b * 8);
+            }
+        }
+    }
+    hash->update(bytes.data(), bytes.size());
+    samples += count;
+}
+
+v8::Local<v8::Value> ContentHashAnalyzer::result() const
+{
+    Nan::EscapableHandleScope scope;
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, Nan::New("algorithm").ToLocalChecked(), Nan::New(Hash::algorithmName(algorithm)).ToLocalChecked());
+    Nan::Set(obj, Nan::New("digest").ToLocalChecked(), Nan::New(hash->digest()).ToLocalChecked());
+    Nan::Set(obj, Nan::New("samples").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(samples)));
+    return scope.Escape(obj);
+}
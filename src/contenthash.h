@@ -0,0 +1,29 @@
+#ifndef CONTENTHASH_H
+#define CONTENTHASH_H
+
+#include "analyzer.h"
+#include "hash.h"
+
+// hash of the decoded audio in the byte layout libFLAC feeds its md5:
+// interleaved little endian samples, (bitsPerSample + 7) / 8 bytes each
+class ContentHashAnalyzer : public Analyzer
+{
+public:
+    explicit ContentHashAnalyzer(Hash::Algorithm algorithm);
+
+    const char* name() const override { return "hash"; }
+
+    void format(uint32_t sampleRate, uint32_t channels, uint32_t bitsPerSample) override;
+    void process(const FLAC__int32* const buffer[], unsigned samples) override;
+
+    v8::Local<v8::Value> result() const override;
+
+private:
+    Hash::Algorithm algorithm;
+    std::unique_ptr<Hash> hash;
+    uint32_t channels, bitsPerSample;
+    uint64_t samples;
+    std::vector<unsigned char> bytes;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include "decodefile.h"
+#include "analyze.h"
+
+class DecodeWorker : public Nan::AsyncWorker
+{
+public:
+    DecodeWorker(Nan::Callback* callback, const FileDecoder::Source& source, bool producing)
+        : Nan::AsyncWorker(callback, "flac:DecodeFile"), decoder(source), output(producing)
+    {
+    }
+
+    FileDecoder decoder;
+
+    void Execute() override
+    {
+        if (!decoder.run())
+            SetErrorMessage(decoder.error().c_str());
+    }
+
+    void HandleOKCallback() override
+    {
+        Nan::HandleScope scope;
+        auto format = [](const FileDecoder::StreamInfo& info) {
+            v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+            Nan::Set(obj, Nan::New("sampleRate").ToLocalChecked(), Nan::New<v8::Number>(info.sampleRate));
+            Nan::Set(obj, Nan::New("channels").ToLocalChecked(), Nan::New<v8::Number>(info.channels));
+            Nan::Set(obj, Nan::New("bitDepth").ToLocalChecked(), Nan::New<v8::Number>(info.bitsPerSample));
+            return obj;
+        };
+        v8::Local<v8::Object> result = format(decoder.info());
+        Nan::Set(result, Nan::New("totalSamples").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(decoder.info().totalSamples)));
+        Nan::Set(result, Nan::New("samples").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(decoder.samplesDecoded())));
+        if (output) {
+            // hand the pcm over without a copy, the buffer frees it
+            std::string* pcm = new std::string();
+            pcm->swap(decoder.pcm());
+            v8::Local<v8::Object> buffer = Nan::NewBuffer(&(*pcm)[0], pcm->size(), [](char*, void* hint) {
+                delete static_cast<std::string*>(hint);
+            }, pcm).ToLocalChecked();
+            Nan::Set(result, Nan::New("format").ToLocalChecked(), format(decoder.outputFormat()));
+            Nan::Set(result, Nan::New("data").ToLocalChecked(), buffer);
+        }
+        if (!decoder.getAnalyzers().empty()) {
+            v8::Local<v8::Object> analysis = Nan::New<v8::Object>();
+            for (const auto& analyzer : decoder.getAnalyzers())
+                Nan::Set(analysis, Nan::New(analyzer->name()).ToLocalChecked(), analyzer->result());
+            Nan::Set(result, Nan::New("analysis").ToLocalChecked(), analysis);
+        }
+
+        v8::Local<v8::Value> argv[] = { Nan::Null(), result };
+        callback->Call(2, argv, async_resource);
+    }
+
+private:
+    bool output;
+};
+
+NAN_METHOD(DecodeFile) {
+    if (!info[2]->IsFunction()) {
+        Nan::ThrowError("Argument must be a function");
+        return;
+    }
+
+    FileDecoder::Source source;
+    if (!parseSource(info[0], &source))
+        return;
+
+    Processor::Options processing;
+    bool output = true;
+    std::vector<std::unique_ptr<Analyzer> > analyzers;
+    if (info[1]->IsObject()) {
+        v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[1]);
+        if (!parseProcessorOptions(options, &processing))
+            return;
+        v8::Local<v8::Value> v;
+        if (Nan::Get(options, Nan::New("output").ToLocalChecked()).ToLocal(&v) && !v->IsUndefined())
+            output = Nan::To<bool>(v).FromMaybe(true);
+        if (Nan::Get(options, Nan::New("analyze").ToLocalChecked()).ToLocal(&v) && !createAnalyzers(v, analyzers))
+            return;
+    }
+
+    DecodeWorker* worker = new DecodeWorker(new Nan::Callback(v8::Local<v8::Function>::Cast(info[2])), source, output);
+    if (output)
+        worker->decoder.setOutput(processing);
+    for (auto& analyzer : analyzers)
+        worker->decoder.addAnalyzer(std::move(analyzer));
+    if (source.data)
+        worker->SaveToPersistent("source", info[0]);
+    Nan::AsyncQueueWorker(worker);
+}
@@ -0,0 +1,10 @@
+#ifndef DECODEFILE_H
+#define DECODEFILE_H
+
+#include <nan.h>
+
+// decodes a whole source to pcm on the thread pool, running the same
+// output processing and analyzers as a FlacDecoder stream
+NAN_METHOD(DecodeFile);
+
+#endif
@@ -0,0 +1,110 @@
+#include "fft.h"
+#include <cmath>
+#include <cstring>
+
+static const double pi = 3.14159265358979323846;
+
+Fft::Fft(unsigned size)
+    : n(size)
+{
+    const unsigned half = n / 2;
+    unsigned bits = 0;
+    while ((1u << bits) < half)
+        ++bits;
+    reverse.resize(half);
+    for (unsigned i = 0; i < half; ++i) {
+        unsigned r = 0;
+        for (unsigned b = 0; b < bits; ++b) {
+            if (i & (1u << b))
+                r |= 1u << (bits - 1 - b);
+        }
+        reverse[i] = r;
+    }
+    twiddles.resize(half / 2);
+    for (unsigned k = 0; k < half / 2; ++k)
+        twiddles[k] = std::polar(1., -2. * pi * k / half);
+    split.resize(half);
+    for (unsigned k = 0; k < half; ++k)
+        split[k] = std::polar(1., -2. * pi * k / n);
+    work.resize(half);
+}
+
+void Fft::transform()
+{
+    const unsigned half = n / 2;
+    for (unsigned i = 0; i < half; ++i) {
+        if (i < reverse[i])
+            std::swap(work[i], work[reverse[i]]);
+    }
+    for (unsigned len = 2; len <= half; len <<= 1) {
+        const unsigned stride = half / len;
+        for (unsigned start = 0; start < half; start += len) {
+            for (unsigned k = 0; k < len / 2; ++k) {
+                const std::complex<float> a = work[start + k];
+                const std::complex<float> b = work[start + k + len / 2] * twiddles[k * stride];
+                work[start + k] = a + b;
+                work[start + k + len / 2] = a - b;
+            }
+        }
+    }
+}
+
+void Fft::power(const float* in, float* out)
+{
+    // even samples as the real part, odd ones as the imaginary part, then
+    // untangle the two half size spectra
+    const unsigned half = n / 2;
+    for (unsigned i = 0; i < half; ++i)
+        work[i] = std::complex<float>(in[2 * i], in[2 * i + 1]);
+    transform();
+
+    const float dc = work[0].real() + work[0].imag(), nyquist = work[0].real() - work[0].imag();
+    out[0] = dc * dc;
+    out[half] = nyquist * nyquist;
+    for (unsigned k = 1; k < half; ++k) {
+        const std::complex<float> z = work[k], zc = std::conj(work[half - k]);
+        const std::complex<float> even = (z + zc) * .5f;
+        const std::complex<float> odd = (z - zc) * std::complex<float>(0.f, -.5f);
+        out[k] = std::norm(even + split[k] * odd);
+    }
+}
+
+std::vector<float> Fft::window(Window window, unsigned size)
+{
+    // periodic windows, they overlap-add evenly at the usual hops
+    std::vector<float> w(size);
+    for (unsigned i = 0; i < size; ++i) {
+        const double x = 2. * pi * i / size;
+        switch (window) {
+        case Window::Hann:
+            w[i] = static_cast<float>(.5 - .5 * std::cos(x));
+            break;
+        case Window::Hamming:
+            w[i] = static_cast<float>(.54 - .46 * std::cos(x));
+            break;
+        case Window::Blackman:
+            w[i] = static_cast<float>(.42 - .5 * std::cos(x) + .08 * std::cos(2. * x));
+            break;
+        case Window::Rectangular:
+            w[i] = 1.f;
+            break;
+        }
+    }
+    return w;
+}
+
+bool Fft::parseWindow(const char* name, Window* window)
+{
+    if (!strcmp(name, "hann")) {
+        *window = Window::Hann;
+    } else if (!strcmp(name, "hamming")) {
+        *window = Window::Hamming;
+    } else if (!strcmp(name, "blackman")) {
+        *window = Window::Blackman;
+    } else if (!strcmp(name, "rectangular")) {
+        *window = Window::Rectangular;
+    } else {
+        return false;
+    }
+    return true;
+}
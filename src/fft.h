@@ -0,0 +1,35 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+#include <vector>
+
+// radix-2 fft of real input, computed as a half size complex transform
+class Fft
+{
+public:
+    enum class Window { Hann, Hamming, Blackman, Rectangular };
+
+    // size must be a power of two, at least 4
+    explicit Fft(unsigned size);
+
+    unsigned size() const { return n; }
+    unsigned bins() const { return n / 2 + 1; }
+
+    // |X[k]|^2 for k in 0 .. size / 2 of size real samples
+    void power(const float* in, float* out);
+
+    static std::vector<float> window(Window window, unsigned size);
+    static bool parseWindow(const char* name, Window* window);
+
+private:
+    void transform();
+
+    unsigned n;
+    std::vector<unsigned> reverse;
+    std::vector<std::complex<float> > twiddles;     // e^-2pi*i*k/(n/2), k < n/4
+    std::vector<std::complex<float> > split;        // e^-2pi*i*k/n, k < n/2
+    std::vector<std::complex<float> > work;
+};
+
+#endif
@@ -0,0 +1,244 @@
+#include "filedecoder.h"
+#include <algorithm>
+#include <cstring>
+
+FileDecoder::FileDecoder(const Source& src)
+    : source(src), decoder(nullptr), position(0), samples(0),
+      md5Checking(false), ranged(false), rangeStart(0), rangeEnd(0), md5Result(Md5::Unchecked), producing(false)
+{
+}
+
+void FileDecoder::setOutput(const Processor::Options& options)
+{
+    producing = true;
+    processor.setOptions(options);
+}
+
+FileDecoder::~FileDecoder()
+{
+    if (decoder) {
+        FLAC__stream_decoder_finish(decoder);
+        FLAC__stream_decoder_delete(decoder);
+    }
+}
+
+void FileDecoder::setRange(uint64_t start, uint64_t end)
+{
+    ranged = true;
+    rangeStart = start;
+    rangeEnd = std::max(start, end);
+}
+
+bool FileDecoder::init()
+{
+    decoder = FLAC__stream_decoder_new();
+    if (decoder == nullptr) {
+        errorString = "Unable to create decoder";
+        return false;
+    }
+
+    FLAC__stream_decoder_set_md5_checking(decoder, md5Checking);
+    // the replaygain tags
+    if (producing)
+        FLAC__stream_decoder_set_metadata_respond(decoder, FLAC__METADATA_TYPE_VORBIS_COMMENT);
+
+    FLAC__StreamDecoderInitStatus status;
+    if (source.data) {
+        status = FLAC__stream_decoder_init_stream(decoder,
+                                                  readCallback,
+                                                  seekCallback,
+                                                  tellCallback,
+                                                  lengthCallback,
+                                                  eofCallback,
+                                                  writeCallback,
+                                                  metadataCallback,
+                                                  errorCallback,
+                                                  this);
+    } else {
+        status = FLAC__stream_decoder_init_file(decoder,
+                                                source.path.c_str(),
+                                                writeCallback,
+                                                metadataCallback,
+                                                errorCallback,
+                                                this);
+    }
+    if (status != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+        errorString = std::string("Failed to initialize flac stream: ") + FLAC__StreamDecoderInitStatusString[status];
+        return false;
+    }
+    return true;
+}
+
+bool FileDecoder::run()
+{
+    if (!init())
+        return false;
+
+    if (ranged) {
+        if (!decodeRange())
+            return false;
+        if (producing)
+            processor.flush(output);
+        for (auto& analyzer : analyzers)
+            analyzer->finish();
+        return true;
+    }
+
+    const bool ok = FLAC__stream_decoder_process_until_end_of_stream(decoder);
+    const FLAC__StreamDecoderState state = FLAC__stream_decoder_get_state(decoder);
+    if (!ok || state != FLAC__STREAM_DECODER_END_OF_STREAM) {
+        errorString = std::string("Failed to decode: ") + FLAC__StreamDecoderStateString[state];
+        return false;
+    }
+
+    if (producing)
+        processor.flush(output);
+    for (auto& analyzer : analyzers)
+        analyzer->finish();
+
+    // finish is where libFLAC compares the md5, it skips streams without one
+    const bool md5Ok = FLAC__stream_decoder_finish(decoder);
+    if (md5Checking && streamInfo.hasMd5)
+        md5Result = md5Ok ? Md5::Match : Md5::Mismatch;
+    return true;
+}
+
+bool FileDecoder::decodeRange()
+{
+    if (!FLAC__stream_decoder_process_until_end_of_metadata(decoder)) {
+        errorString = std::string("Failed to decode: ") + FLAC__StreamDecoderStateString[FLAC__stream_decoder_get_state(decoder)];
+        return false;
+    }
+    if (rangeStart == rangeEnd)
+        return true;
+    if (streamInfo.totalSamples && rangeStart >= streamInfo.totalSamples) {
+        errorString = "Range starts past the end of the stream";
+        return false;
+    }
+
+    // the seek itself delivers the first frame, starting at rangeStart
+    if (!FLAC__stream_decoder_seek_absolute(decoder, rangeStart)) {
+        errorString = std::string("Failed to seek: ") + FLAC__StreamDecoderStateString[FLAC__stream_decoder_get_state(decoder)];
+        return false;
+    }
+    while (rangeStart + samples < rangeEnd) {
+        const FLAC__StreamDecoderState state = FLAC__stream_decoder_get_state(decoder);
+        if (state == FLAC__STREAM_DECODER_END_OF_STREAM)
+            break;
+        if (!FLAC__stream_decoder_process_single(decoder)) {
+            errorString = std::string("Failed to decode: ") + FLAC__StreamDecoderStateString[FLAC__stream_decoder_get_state(decoder)];
+            return false;
+        }
+    }
+    return true;
+}
+
+FLAC__StreamDecoderReadStatus FileDecoder::readCallback(const FLAC__StreamDecoder */*decoder*/, FLAC__byte buffer[], size_t *bytes, void *client_data)
+{
+    FileDecoder* dec = static_cast<FileDecoder*>(client_data);
+    const size_t toread = std::min<uint64_t>(*bytes, dec->source.size - dec->position);
+    memcpy(buffer, dec->source.data + dec->position, toread);
+    dec->position += toread;
+    *bytes = toread;
+    if (!toread)
+        return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+    return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+FLAC__StreamDecoderSeekStatus FileDecoder::seekCallback(const FLAC__StreamDecoder */*decoder*/, FLAC__uint64 absolute_byte_offset, void *client_data)
+{
+    FileDecoder* dec = static_cast<FileDecoder*>(client_data);
+    if (absolute_byte_offset > dec->source.size)
+        return FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
+    dec->position = absolute_byte_offset;
+    return FLAC__STREAM_DECODER_SEEK_STATUS_OK;
+}
+
+FLAC__StreamDecoderTellStatus FileDecoder::tellCallback(const FLAC__StreamDecoder */*decoder*/, FLAC__uint64 *absolute_byte_offset, void *client_data)
+{
+    *absolute_byte_offset = static_cast<FileDecoder*>(client_data)->position;
+    return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+}
+
+FLAC__StreamDecoderLengthStatus FileDecoder::lengthCallback(const FLAC__StreamDecoder */*decoder*/, FLAC__uint64 *stream_length, void *client_data)
+{
+    *stream_length = static_cast<FileDecoder*>(client_data)->source.size;
+    return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
+}
+
+FLAC__bool FileDecoder::eofCallback(const FLAC__StreamDecoder */*decoder*/, void *client_data)
+{
+    FileDecoder* dec = static_cast<FileDecoder*>(client_data);
+    return dec->position >= dec->source.size;
+}
+
+FLAC__StreamDecoderWriteStatus FileDecoder::writeCallback(const FLAC__StreamDecoder */*decoder*/, const FLAC__Frame *frame, const FLAC__int32 *const buffer[], void *client_data)
+{
+    FileDecoder* dec = static_cast<FileDecoder*>(client_data);
+    const FLAC__FrameHeader& header = frame->header;
+    if (header.sample_rate != dec->currentFormat.sampleRate
+        || header.channels != dec->currentFormat.channels
+        || header.bits_per_sample != dec->currentFormat.bitsPerSample) {
+        dec->currentFormat.sampleRate = header.sample_rate;
+        dec->currentFormat.channels = header.channels;
+        dec->currentFormat.bitsPerSample = header.bits_per_sample;
+        for (auto& analyzer : dec->analyzers)
+            analyzer->format(header.sample_rate, header.channels, header.bits_per_sample);
+        if (dec->producing) {
+            Processor& processor = dec->processor;
+            processor.configure(header.sample_rate, header.channels, header.bits_per_sample, dec->output);
+            dec->outFormat.sampleRate = processor.sampleRate();
+            dec->outFormat.channels = processor.channels();
+            dec->outFormat.bitsPerSample = processor.bitsPerSample();
+            if (dec->output.empty() && dec->streamInfo.totalSamples) {
+                // one allocation for the whole stream, give or take resampling
+                const double frames = static_cast<double>(dec->streamInfo.totalSamples) * processor.sampleRate() / header.sample_rate;
+                dec->output.reserve(static_cast<size_t>(frames + 64) * processor.channels() * processor.bitsPerSample() / 8);
+            }
+        }
+    }
+
+    unsigned count = header.blocksize;
+    if (dec->ranged) {
+        // the seek lands on rangeStart, only the end needs trimming
+        const uint64_t left = dec->rangeEnd - std::min(dec->rangeEnd, dec->rangeStart + dec->samples);
+        count = static_cast<unsigned>(std::min<uint64_t>(count, left));
+        if (!count)
+            return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+    }
+
+    for (auto& analyzer : dec->analyzers)
+        analyzer->process(buffer, count);
+    if (dec->producing)
+        dec->processor.process(buffer, count, dec->output);
+    dec->samples += count;
+
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+void FileDecoder::metadataCallback(const FLAC__StreamDecoder */*decoder*/, const FLAC__StreamMetadata *metadata, void *client_data)
+{
+    FileDecoder* dec = static_cast<FileDecoder*>(client_data);
+    if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
+        const auto& info = metadata->data.stream_info;
+        dec->streamInfo.sampleRate = info.sample_rate;
+        dec->streamInfo.channels = info.channels;
+        dec->streamInfo.bitsPerSample = info.bits_per_sample;
+        dec->streamInfo.totalSamples = info.total_samples;
+        for (FLAC__byte b : info.md5sum) {
+            if (b)
+                dec->streamInfo.hasMd5 = true;
+        }
+    } else if (metadata->type == FLAC__METADATA_TYPE_VORBIS_COMMENT) {
+        dec->processor.setTags(Processor::parseTags(metadata->data.vorbis_comment));
+    }
+}
+
+void FileDecoder::errorCallback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
+{
+    FileDecoder* dec = static_cast<FileDecoder*>(client_data);
+    FLAC__uint64 byte;
+    if (!FLAC__stream_decoder_get_decode_position(decoder, &byte))
+        byte = UINT64_MAX;
+    dec->errors.push_back(DecodeError{ FLAC__StreamDecoderErrorStatusString[status], dec->samples, byte });
+}
@@ -0,0 +1,102 @@
+#ifndef FILEDECODER_H
+#define FILEDECODER_H
+
+#include <FLAC/stream_decoder.h>
+#include "analyzer.h"
+#include "processor.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// decodes a whole file or in-memory stream synchronously, meant to run on
+// the libuv thread pool. decoded frames are handed to the analyzers and,
+// when asked for, interleaved into one pcm buffer. nothing is posted to js.
+class FileDecoder
+{
+public:
+    struct Source
+    {
+        std::string path;
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+    };
+
+    struct StreamInfo
+    {
+        uint32_t sampleRate = 0;
+        uint32_t channels = 0;
+        uint32_t bitsPerSample = 0;
+        uint64_t totalSamples = 0;
+        bool hasMd5 = false;
+    };
+
+    // a recoverable stream error libFLAC reported while decoding
+    struct DecodeError
+    {
+        const char* status;
+        uint64_t sample;    // first sample after the last good frame
+        uint64_t byte;      // decoder input position, when known
+    };
+
+    enum class Md5 { Unchecked, Match, Mismatch };
+
+    explicit FileDecoder(const Source& source);
+    ~FileDecoder();
+
+    void addAnalyzer(std::unique_ptr<Analyzer>&& analyzer) { analyzers.push_back(std::move(analyzer)); }
+    const std::vector<std::unique_ptr<Analyzer> >& getAnalyzers() const { return analyzers; }
+
+    // has libFLAC compare the decoded audio against the STREAMINFO md5
+    void setMd5Checking(bool check) { md5Checking = check; }
+
+    // runs the decoded audio through a Processor into pcm()
+    void setOutput(const Processor::Options& options);
+
+    // only decodes samples [start, end) by seeking to start, the md5 can't
+    // be checked then. an empty range only reads the metadata
+    void setRange(uint64_t start, uint64_t end);
+
+    bool run();
+
+    const std::string& error() const { return errorString; }
+    const StreamInfo& info() const { return streamInfo; }
+    const std::vector<DecodeError>& decodeErrors() const { return errors; }
+    Md5 md5() const { return md5Result; }
+    uint64_t samplesDecoded() const { return samples; }
+    // the interleaved output and its format, when setOutput was called
+    std::string& pcm() { return output; }
+    const StreamInfo& outputFormat() const { return outFormat; }
+
+private:
+    bool init();
+    bool decodeRange();
+
+    static FLAC__StreamDecoderReadStatus readCallback(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data);
+    static FLAC__StreamDecoderSeekStatus seekCallback(const FLAC__StreamDecoder *decoder, FLAC__uint64 absolute_byte_offset, void *client_data);
+    static FLAC__StreamDecoderTellStatus tellCallback(const FLAC__StreamDecoder *decoder, FLAC__uint64 *absolute_byte_offset, void *client_data);
+    static FLAC__StreamDecoderLengthStatus lengthCallback(const FLAC__StreamDecoder *decoder, FLAC__uint64 *stream_length, void *client_data);
+    static FLAC__bool eofCallback(const FLAC__StreamDecoder *decoder, void *client_data);
+    static FLAC__StreamDecoderWriteStatus writeCallback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 *const buffer[], void *client_data);
+    static void metadataCallback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data);
+    static void errorCallback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data);
+
+    Source source;
+    FLAC__StreamDecoder* decoder;
+    uint64_t position;
+    uint64_t samples;
+    bool md5Checking;
+    bool ranged;
+    uint64_t rangeStart, rangeEnd;
+    Md5 md5Result;
+    std::vector<DecodeError> errors;
+    StreamInfo streamInfo;
+    StreamInfo currentFormat;
+    std::string errorString;
+    std::vector<std::unique_ptr<Analyzer> > analyzers;
+    bool producing;
+    Processor processor;
+    std::string output;
+    StreamInfo outFormat;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "fingerprint.h"
+#include <algorithm>
+#include <cmath>
+
+constexpr uint32_t FingerprintAnalyzer::rate;
+constexpr unsigned FingerprintAnalyzer::frameSize, FingerprintAnalyzer::hop;
+
+FingerprintAnalyzer::FingerprintAnalyzer()
+    : channels(0), scale(1.f), fft(frameSize), window(Fft::window(Fft::Window::Hamming, frameSize)),
+      offset(0), resampled(0), windowed(frameSize), spectrum(fft.bins())
+{
+    // A0 (27.5Hz) up to A7 (3520Hz), pitch class 0 is A
+    pitchClass.assign(fft.bins(), -1);
+    for (unsigned k = 1; k < fft.bins(); ++k) {
+        const double freq = static_cast<double>(k) * rate / frameSize;
+        if (freq < 27.5 || freq > 3520.)
+            continue;
+        const long note = std::lround(12. * std::log2(freq / 27.5));
+        pitchClass[k] = static_cast<int>(note % 12);
+    }
+    std::fill(previous, previous + 12, 0.f);
+}
+
+void FingerprintAnalyzer::format(uint32_t sampleRate, uint32_t count, uint32_t bitsPerSample)
+{
+    // a format change keeps the pending 11025Hz audio, only the resampler
+    // history is lost
+    channels = count;
+    scale = 1.f / static_cast<float>(1u << (bitsPerSample - 1)) / count;
+    resampler.init(sampleRate, rate, 1, Resampler::Quality::Fast);
+}
+
+void FingerprintAnalyzer::process(const FLAC__int32* const buffer[], unsigned samples)
+{
+    mono.resize(samples);
+    for (unsigned i = 0; i < samples; ++i) {
+        int64_t sum = 0;
+        for (uint32_t c = 0; c < channels; ++c)
+            sum += buffer[c][i];
+        mono[i] = static_cast<float>(sum) * scale;
+    }
+    if (resampler.active()) {
+        const float* in[] = { mono.data() };
+        resampler.process(in, samples, &pending);
+    } else {
+        pending.insert(pending.end(), mono.begin(), mono.end());
+    }
+
+    while (pending.size() - offset >= frameSize) {
+        frame(pending.data() + offset);
+        offset += hop;
+    }
+    if (offset >= pending.size() / 2) {
+        resampled += offset;
+        pending.erase(pending.begin(), pending.begin() + offset);
+        offset = 0;
+    }
+}
+
+void FingerprintAnalyzer::frame(const float* samples)
+{
+    for (unsigned i = 0; i < frameSize; ++i)
+        windowed[i] = samples[i] * window[i];
+    fft.power(windowed.data(), spectrum.data());
+
+    float chroma[12] = {};
+    for (unsigned k = 0; k < spectrum.size(); ++k) {
+        if (pitchClass[k] >= 0)
+            chroma[pitchClass[k]] += spectrum[k];
+    }
+    double norm = 0.;
+    for (float v : chroma)
+        norm += static_cast<double>(v) * v;
+    norm = std::sqrt(norm);
+    for (float& v : chroma)
+        v = norm > 1e-9 ? static_cast<float>(v / norm) : 0.f;
+
+    // bits 0-11: pitch class got stronger since the last frame, 12-23: it
+    // is stronger than the next semitone, 24-31: than the minor third above
+    uint32_t word = 0;
+    for (unsigned i = 0; i < 12; ++i) {
+        if (chroma[i] > previous[i])
+            word |= 1u << i;
+        if (chroma[i] > chroma[(i + 1) % 12])
+            word |= 1u << (12 + i);
+        if (i < 8 && chroma[i] > chroma[i + 3])
+            word |= 1u << (24 + i);
+    }
+    words.push_back(word);
+    std::copy(chroma, chroma + 12, previous);
+}
+
+void FingerprintAnalyzer::finish()
+{
+    resampled += pending.size();
+    pending.clear();
+    offset = 0;
+}
+
+v8::Local<v8::Value> FingerprintAnalyzer::result() const
+{
+    Nan::EscapableHandleScope scope;
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, Nan::New("frameRate").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(rate) / hop));
+    Nan::Set(obj, Nan::New("duration").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(resampled) / rate));
+    Nan::Set(obj, Nan::New("fingerprint").ToLocalChecked(), toTypedArray<uint32_t, v8::Uint32Array>(words));
+    return scope.Escape(obj);
+}
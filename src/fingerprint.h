@@ -0,0 +1,46 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include "analyzer.h"
+#include "fft.h"
+#include "resampler.h"
+
+// chroma based acoustic fingerprint: the stream is folded to mono, resampled
+// to 11025Hz and every frame of the short-time spectrum is reduced to a 12
+// bin chroma vector, then to one 32 bit word per frame
+class FingerprintAnalyzer : public Analyzer
+{
+public:
+    FingerprintAnalyzer();
+
+    const char* name() const override { return "fingerprint"; }
+
+    void format(uint32_t sampleRate, uint32_t channels, uint32_t bitsPerSample) override;
+    void process(const FLAC__int32* const buffer[], unsigned samples) override;
+    void finish() override;
+
+    v8::Local<v8::Value> result() const override;
+
+    static constexpr uint32_t rate = 11025;
+    static constexpr unsigned frameSize = 4096, hop = frameSize / 3;
+
+private:
+    void frame(const float* samples);
+
+    uint32_t channels;
+    float scale;
+    Resampler resampler;
+    Fft fft;
+    std::vector<float> window;
+    std::vector<int> pitchClass;    // per fft bin, -1 outside the note range
+
+    std::vector<float> mono;
+    std::vector<float> pending;     // 11025Hz mono not yet consumed by a frame
+    size_t offset;
+    uint64_t resampled;
+    std::vector<float> windowed, spectrum;
+    float previous[12];
+    std::vector<uint32_t> words;
+};
+
+#endif
@@ -3,6 +3,15 @@
 #include <node.h>
 #include <node_buffer.h>
 #include <FLAC/stream_decoder.h>
+#include "analyze.h"
+#include "decodefile.h"
+#include "metrics.h"
+#include "processor.h"
+#include "ring.h"
+#include "stats.h"
+#include "trace.h"
+#include <set>
+#include <unordered_map>
 #include <variant>
 #include <cstring>
 
@@ -12,15 +21,79 @@ constexpr auto to_underlying(E e) noexcept
     return static_cast<std::underlying_type_t<E>>(e);
 }
 
+struct Data;
+
+// the addon state of one node environment, the main thread or a worker.
+// every environment loading the addon gets its own, handed to the methods
+// as their data, and decoders deliver on that environment's loop
+struct AddonData
+{
+    explicit AddonData(v8::Isolate* isolate);
+
+    v8::Isolate* isolate;
+    uv_loop_t* loop;
+
+    Nan::Global<v8::Private> extName;
+
+    // idle instances, decoder and thread kept warm for the next Open
+    std::vector<Data*> pool;
+    size_t poolSize;
+    // instances attached to a js handle, torn down with the environment
+    std::set<Data*> open;
+
+    // format objects all share the template's shape, tag names are
+    // internalized once and kept
+    Nan::Global<v8::ObjectTemplate> formatTemplate;
+    Nan::Global<v8::String> formatKeys[3];
+    std::unordered_map<std::string, Nan::Global<v8::String> > tagKeys;
+    v8::Local<v8::String> tagKey(const std::string& name);
+
+    static AddonData* fromInfo(Nan::NAN_METHOD_ARGS_TYPE info);
+    static void cleanup(void* arg);
+};
+
 struct Data
 {
-    Data();
+    explicit Data(AddonData* addon);
     ~Data();
 
-    static uint32_t openCount;
-    static Nan::Persistent<v8::Private> extName;
+    AddonData* addon;
+
+    struct Options
+    {
+        Processor::Options processing;
+        bool output = true;
+        bool md5 = false;
+        // skip everything optional: md5, metadata parsing
+        bool trusted = false;
+        // one js call per wakeup instead of one per message
+        bool batch = false;
+        // pcm goes to this SharedArrayBuffer ring instead of to js
+        std::shared_ptr<v8::BackingStore> ring;
+        // only decode as many pcm chunks as js has asked for with Request
+        bool pull = false;
+        // Feed takes up to this many bytes ahead of the decoder before it
+        // asks js to wait for a Done. 0 waits for the input to run dry
+        size_t inputBudget = 0;
+        // latency tracing, the number of trace events kept per thread
+        size_t trace = 0;
+    };
 
     bool stopped, needsDone;
+    // eof: js has no more input, needsDrain: js waits for the queued
+    // input to drop under the budget
+    bool eof, needsDrain;
+    size_t queued;
+    // running: the thread is decoding a stream, attached: a js handle owns
+    // this instance, quit: the thread should exit
+    bool running, attached, quit;
+    // pcm chunks js still wants in pull mode
+    size_t requested;
+    // the decoder settings of the last init, a reset keeps them
+    bool initMd5, initTrusted;
+    bool hasMd5;
+    const char* md5Result;
+    Options options;
     Nan::Persistent<v8::Context> context;
     Nan::Persistent<v8::Function> callback;
     Nan::Persistent<v8::Object> weak;
@@ -31,11 +104,13 @@ struct Data
     uv_thread_t thread;
     uv_mutex_t mutex;
     uv_cond_t cond;
+    uv_cond_t idle;
 
     struct BufferData
     {
         size_t where;
         std::string buffer;
+        uint64_t fedAt = 0; // when tracing
     };
     std::vector<BufferData> inbuffers;
 
@@ -53,20 +128,50 @@ struct Data
 
     struct Message
     {
-        enum class Type { Format, Metadata, Data, Done, End };
+        // Batch only exists on the js side, an array of type, data pairs
+        enum class Type { Format, Metadata, Data, Done, End, Analysis, Batch, Trace };
 
         Type type;
         std::variant<Format, Metadata, std::string> data;
+        // when tracing, the feed time of the input that completed the frame
+        // and the decode time of the pcm
+        uint64_t fedAt = 0, decodedAt = 0;
     };
 
     std::vector<Message> messages;
 
     Format currentFormat;
+    Processor processor;
+    Ring ring;
+    DecoderStats stats;
+    // time the decoder thread spent blocked inside process_single, it
+    // doesn't count as decoding
+    uint64_t waitNs;
+    std::unique_ptr<Tracer> tracer;
+    uint64_t lastFedAt;
+    // counts the streams this instance ran, a pooled instance can start a
+    // new one while asyncCallback still delivers the old one's messages
+    uint64_t generation;
+    std::vector<std::unique_ptr<Analyzer> > analyzers;
 
     bool formatChanged(const FLAC__Frame* frame) const;
     void pushFormat(const FLAC__Frame* frame);
+    void writeRing(const std::string& pcm);
+    void drainRing();
+    void post(Message&& message);
+    v8::Local<v8::Value> statsValue() const;
+
+    static bool parseOptions(v8::Local<v8::Value> value, Options* options);
 
-    void close();
+    static Data* acquire(AddonData* addon);
+    bool start();
+    bool begin();
+    void decode();
+    void close(bool collected = false);
+    void release();
+    void destroy();
+
+    static bool fromHandle(AddonData* addon, v8::Local<v8::Value> value, Data** data);
 
     static FLAC__StreamDecoderReadStatus readCallback(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data);
     static FLAC__StreamDecoderWriteStatus writeCallback(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 *const buffer[], void *client_data);
@@ -75,73 +180,309 @@ struct Data
 
     static void flacThread(void* arg);
     static void asyncCallback(uv_async_t* handle);
+    v8::Local<v8::Value> messageValue(const Message& message);
+    v8::Local<v8::Value> dataValue(const Message* begin, const Message* end);
 
     static void weakCallback(const Nan::WeakCallbackInfo<Data> &data);
 };
 
-uint32_t Data::openCount = 0;
-Nan::Persistent<v8::Private> Data::extName;
+static v8::Local<v8::String> internalize(v8::Isolate* isolate, const std::string& str)
+{
+    return v8::String::NewFromUtf8(isolate, str.c_str(), v8::NewStringType::kInternalized, static_cast<int>(str.size())).ToLocalChecked();
+}
+
+AddonData::AddonData(v8::Isolate* iso)
+    : isolate(iso), loop(Nan::GetCurrentEventLoop()), poolSize(4)
+{
+    v8::Local<v8::Private> ext = v8::Private::New(isolate, internalize(isolate, "ext"));
+    extName.Reset(ext);
+}
+
+AddonData* AddonData::fromInfo(Nan::NAN_METHOD_ARGS_TYPE info)
+{
+    return static_cast<AddonData*>(v8::Local<v8::External>::Cast(info.Data())->Value());
+}
+
+// runs when the environment goes away, a worker exiting or the process
+// shutting down. weak callbacks don't run then so the open instances are
+// stopped here, and every decoder thread is joined before the loop closes
+void AddonData::cleanup(void* arg)
+{
+    AddonData* addon = static_cast<AddonData*>(arg);
+    addon->poolSize = 0;
+    while (!addon->open.empty()) {
+        Data* data = *addon->open.begin();
+        delete data->weak.ClearWeak<Nan::WeakCallbackInfo<Data> >();
+        data->close(true);
+    }
+    for (Data* data : addon->pool)
+        data->destroy();
+    addon->pool.clear();
+    delete addon;
+}
+
+v8::Local<v8::String> AddonData::tagKey(const std::string& name)
+{
+    // tag names are few and repeat across files, but they come from the
+    // stream so the cache is bounded
+    enum { MaxTagKeys = 256 };
+    auto it = tagKeys.find(name);
+    if (it != tagKeys.end())
+        return Nan::New(it->second);
+    v8::Local<v8::String> key = internalize(isolate, name);
+    if (tagKeys.size() < MaxTagKeys)
+        tagKeys[name].Reset(key);
+    return key;
+}
 
-Data::Data()
-    : stopped(false), needsDone(false), decoder(nullptr)
+Data::Data(AddonData* a)
+    : addon(a), stopped(false), needsDone(false), eof(false), needsDrain(false), queued(0), running(false), attached(false), quit(false), requested(0),
+      initMd5(false), initTrusted(false), hasMd5(false), md5Result("unchecked"), decoder(nullptr), waitNs(0), lastFedAt(0), generation(0)
 {
     memset(&currentFormat, '\0', sizeof(currentFormat));
     memset(&async, '\0', sizeof(async));
 
     uv_mutex_init(&mutex);
     uv_cond_init(&cond);
+    uv_cond_init(&idle);
 }
 
 Data::~Data()
 {
+    uv_cond_destroy(&idle);
     uv_cond_destroy(&cond);
     uv_mutex_destroy(&mutex);
 }
 
+Data* Data::acquire(AddonData* addon)
+{
+    if (!addon->pool.empty()) {
+        Data* data = addon->pool.back();
+        addon->pool.pop_back();
+        return data;
+    }
+    Data* data = new Data(addon);
+    if (!data->start()) {
+        delete data;
+        return nullptr;
+    }
+    return data;
+}
+
+// creates the decoder, the decoder thread and the async handle, once per
+// instance. throws and returns false on failure
+bool Data::start()
+{
+    decoder = FLAC__stream_decoder_new();
+    if (decoder == nullptr) {
+        Nan::ThrowError("Unable to create decoder");
+        return false;
+    }
+
+    if (uv_thread_create(&thread, flacThread, this) < 0) {
+        FLAC__stream_decoder_delete(decoder);
+        Nan::ThrowError("Failed to init thread");
+        return false;
+    }
+
+    if (uv_async_init(addon->loop, &async, asyncCallback) < 0) {
+        uv_mutex_lock(&mutex);
+        quit = true;
+        uv_cond_signal(&cond);
+        uv_mutex_unlock(&mutex);
+        uv_thread_join(&thread);
+        FLAC__stream_decoder_delete(decoder);
+        Nan::ThrowError("Failed to init async handle");
+        return false;
+    }
+    async.data = this;
+    GlobalMetrics::add(GlobalMetrics::instance().decoderThreads, 1);
+    // only an attached instance keeps the loop alive
+    uv_unref(reinterpret_cast<uv_handle_t*>(&async));
+    return true;
+}
+
+// prepares an idle instance for a new stream with the current options.
+// a decoder with the same settings is only reset, anything else needs a
+// new init since the settings can't change on an initialized decoder
+bool Data::begin()
+{
+    stopped = needsDone = eof = needsDrain = hasMd5 = false;
+    requested = queued = 0;
+    waitNs = lastFedAt = 0;
+    ++generation;
+    stats.reset();
+    tracer.reset(options.trace ? new Tracer(options.trace) : nullptr);
+    md5Result = "unchecked";
+    memset(&currentFormat, '\0', sizeof(currentFormat));
+    inbuffers.clear();
+    messages.clear();
+    processor = Processor();
+    processor.setOptions(options.processing);
+    if (options.ring) {
+        ring.attach(options.ring->Data(), options.ring->ByteLength());
+        ring.begin();
+    } else {
+        ring.detach();
+    }
+
+    const FLAC__StreamDecoderState state = FLAC__stream_decoder_get_state(decoder);
+    if (state != FLAC__STREAM_DECODER_UNINITIALIZED) {
+        if (initMd5 == options.md5 && initTrusted == options.trusted && FLAC__stream_decoder_reset(decoder))
+            return true;
+        FLAC__stream_decoder_finish(decoder);
+    }
+
+    // finish puts the settings back to the defaults
+    FLAC__stream_decoder_set_md5_checking(decoder, options.md5);
+    if (options.trusted) {
+        FLAC__stream_decoder_set_metadata_ignore_all(decoder);
+    } else {
+        FLAC__stream_decoder_set_metadata_respond(decoder, FLAC__METADATA_TYPE_VORBIS_COMMENT);
+    }
+    initMd5 = options.md5;
+    initTrusted = options.trusted;
+
+    return FLAC__stream_decoder_init_stream(decoder,
+                                            readCallback,
+                                            nullptr,
+                                            nullptr,
+                                            nullptr,
+                                            nullptr,
+                                            writeCallback,
+                                            metadataCallback,
+                                            errorCallback,
+                                            this) == FLAC__STREAM_DECODER_INIT_STATUS_OK;
+}
+
 inline bool Data::formatChanged(const FLAC__Frame* frame) const
 {
-    uint32_t bps = frame->header.bits_per_sample;
-    if (bps == 24)
-        bps = 32;
-    if (frame->header.sample_rate != currentFormat.sampleRate
-        || frame->header.channels != currentFormat.channels
-        || bps != currentFormat.bitsPerSample)
-        return true;
-    return false;
+    return !processor.matches(frame->header.sample_rate,
+                              frame->header.channels,
+                              frame->header.bits_per_sample);
 }
 
 inline void Data::pushFormat(const FLAC__Frame* frame)
 {
-    currentFormat.sampleRate = frame->header.sample_rate;
-    currentFormat.channels = frame->header.channels;
-    uint32_t bps = frame->header.bits_per_sample;
-    if (bps == 24)
-        bps = 32;
-    currentFormat.bitsPerSample = bps;
-    messages.push_back(Message{ Message::Type::Format, currentFormat });
+    for (auto& analyzer : analyzers) {
+        analyzer->format(frame->header.sample_rate,
+                         frame->header.channels,
+                         frame->header.bits_per_sample);
+    }
+    // the previous format's resampler tail goes out ahead of the new format
+    std::string tail;
+    processor.configure(frame->header.sample_rate,
+                        frame->header.channels,
+                        frame->header.bits_per_sample,
+                        tail);
+    if (!tail.empty()) {
+        DecoderStats::add(stats.bytesOutput, tail.size());
+        GlobalMetrics::add(GlobalMetrics::instance().bytesOutput, tail.size());
+        if (ring.attached())
+            writeRing(tail);
+        else
+            post(Message{ Message::Type::Data, std::move(tail) });
+    }
+    currentFormat.sampleRate = processor.sampleRate();
+    currentFormat.channels = processor.channels();
+    currentFormat.bitsPerSample = processor.bitsPerSample();
+    if (ring.attached()) {
+        // the format slots cover all unread bytes, wait for the reader to
+        // finish off the previous format before switching
+        drainRing();
+        ring.setFormat(currentFormat.sampleRate, currentFormat.channels, currentFormat.bitsPerSample);
+    }
+    post(Message{ Message::Type::Format, currentFormat });
+}
+
+bool Data::parseOptions(v8::Local<v8::Value> value, Options* options)
+{
+    *options = Options();
+    if (!value->IsObject())
+        return true;
+
+    auto get = [](v8::Local<v8::Object> obj, const char* name) {
+        v8::Local<v8::Value> v;
+        if (!Nan::Get(obj, Nan::New(name).ToLocalChecked()).ToLocal(&v))
+            return v8::Local<v8::Value>(Nan::Undefined());
+        return v;
+    };
+
+    v8::Local<v8::Object> obj = v8::Local<v8::Object>::Cast(value);
+    v8::Local<v8::Value> output = get(obj, "output");
+    if (!output->IsUndefined())
+        options->output = Nan::To<bool>(output).FromMaybe(true);
+    options->md5 = Nan::To<bool>(get(obj, "md5")).FromMaybe(false);
+    options->trusted = Nan::To<bool>(get(obj, "trusted")).FromMaybe(false);
+    if (options->trusted)
+        options->md5 = false;
+    options->batch = Nan::To<bool>(get(obj, "batch")).FromMaybe(false);
+    options->pull = Nan::To<bool>(get(obj, "pull")).FromMaybe(false);
+    v8::Local<v8::Value> budget = get(obj, "inputBudget");
+    if (!budget->IsUndefined()) {
+        const double bytes = Nan::To<double>(budget).FromMaybe(-1);
+        if (!(bytes >= 0)) {
+            Nan::ThrowError("inputBudget must be a number of bytes");
+            return false;
+        }
+        options->inputBudget = static_cast<size_t>(bytes);
+    }
+    v8::Local<v8::Value> trace = get(obj, "trace");
+    if (trace->IsNumber())
+        options->trace = Nan::To<uint32_t>(trace).FromMaybe(0);
+    else if (Nan::To<bool>(trace).FromMaybe(false))
+        options->trace = 16384;
+    v8::Local<v8::Value> ring = get(obj, "ring");
+    if (!ring->IsUndefined()) {
+        if (!ring->IsSharedArrayBuffer()) {
+            Nan::ThrowError("ring must be a SharedArrayBuffer");
+            return false;
+        }
+        options->ring = v8::Local<v8::SharedArrayBuffer>::Cast(ring)->GetBackingStore();
+        if (!Ring::fits(options->ring->ByteLength())) {
+            Nan::ThrowError("ring must be a 64 byte header followed by a power of two data size");
+            return false;
+        }
+    }
+    return parseProcessorOptions(obj, &options->processing);
 }
 
 FLAC__StreamDecoderReadStatus Data::readCallback(const FLAC__StreamDecoder */*decoder*/, FLAC__byte buffer[], size_t *bytes, void *client_data)
 {
     Data* data = static_cast<Data*>(client_data);
+    if (!data->stopped && !data->eof && data->inbuffers.empty())
+        DecoderStats::add(data->stats.starved, 1);
+    const uint64_t waitStart = uv_hrtime();
+    bool waited = false;
     while (!data->stopped && data->inbuffers.empty()) {
+        if (data->eof) {
+            *bytes = 0;
+            return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+        }
         // if we need more data, wait
         if (data->needsDone) {
             data->needsDone = false;
-            data->messages.push_back(Message{ Message::Type::Done, std::string() });
+            data->post(Message{ Message::Type::Done, std::string() });
             uv_async_send(&data->async);
         }
         uv_cond_wait(&data->cond, &data->mutex);
+        waited = true;
     }
+    const uint64_t waitedNs = uv_hrtime() - waitStart;
+    data->waitNs += waitedNs;
+    if (waited && data->tracer)
+        data->tracer->decoder.add(Tracer::Event{ "starved", 'X', waitStart, waitedNs, nullptr, 0 });
     if (data->stopped) {
         *bytes = 0;
         return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
     }
 
-    data->needsDone = true;
+    // with a budget Feed acks by itself, see below
+    data->needsDone = !data->options.inputBudget;
     size_t rem = *bytes, where = 0;
     while (rem && !data->inbuffers.empty()) {
         auto& front = data->inbuffers.front();
+        data->lastFedAt = front.fedAt;
 
         const size_t toread = std::min(front.buffer.size() - front.where, rem);
         memcpy(buffer + where, front.buffer.data() + front.where, toread);
@@ -154,6 +495,16 @@ FLAC__StreamDecoderReadStatus Data::readCallback(const FLAC__StreamDecoder */*de
         }
     }
 
+    data->queued -= where;
+    DecoderStats::add(data->stats.bytesDecoded, where);
+    GlobalMetrics::add(GlobalMetrics::instance().bytesDecoded, where);
+    DecoderStats::sub(data->stats.inputQueued, where);
+    if (data->needsDrain && data->queued < data->options.inputBudget) {
+        data->needsDrain = false;
+        data->post(Message{ Message::Type::Done, std::string() });
+        uv_async_send(&data->async);
+    }
+
     *bytes = where;
     return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
 }
@@ -165,45 +516,37 @@ FLAC__StreamDecoderWriteStatus Data::writeCallback(const FLAC__StreamDecoder *de
         data->pushFormat(frame);
         uv_async_send(&data->async);
     }
-    uint32_t bps = frame->header.bits_per_sample;
-    if (bps == 24)
-        bps = 32;
-    const uint32_t frameSamples = frame->header.blocksize * frame->header.channels * (bps / 8);
 
-    std::string dt;
-    dt.resize(frameSamples);
-    unsigned char* ptr = reinterpret_cast<unsigned char*>(&dt[0]);
-
-    for (unsigned i = 0; i < frame->header.blocksize; ++i) {
-        for (unsigned int j = 0; j < frame->header.channels; ++j) {
-            switch (frame->header.bits_per_sample) {
-            case 8:
-                *(ptr++) = buffer[j][i];
-                break;
-            case 16:
-                *(ptr++) = buffer[j][i];
-                *(ptr++) = buffer[j][i] >> 8;
-                break;
-            case 24:
-                *(ptr++) = 0;
-                *(ptr++) = buffer[j][i];
-                *(ptr++) = buffer[j][i] >> 8;
-                *(ptr++) = buffer[j][i] >> 16;
-                break;
-            case 32:
-                *(ptr++) = buffer[j][i];
-                *(ptr++) = buffer[j][i] >> 8;
-                *(ptr++) = buffer[j][i] >> 16;
-                *(ptr++) = buffer[j][i] >> 24;
-                break;
-            }
-        }
+    for (auto& analyzer : data->analyzers) {
+        analyzer->process(buffer, frame->header.blocksize);
+    }
+    DecoderStats::add(data->stats.frames, 1);
+    DecoderStats::add(data->stats.samples, frame->header.blocksize);
+    GlobalMetrics& metrics = GlobalMetrics::instance();
+    GlobalMetrics::add(metrics.frames, 1);
+    GlobalMetrics::add(metrics.samples, frame->header.blocksize);
+    uint64_t decodedAt = 0;
+    if (data->tracer) {
+        decodedAt = uv_hrtime();
+        data->tracer->feedToDecode.record(decodedAt - std::min(data->lastFedAt, decodedAt));
     }
 
-    // printf("wrote %u (%u)\n", frameSamples, ptr - reinterpret_cast<unsigned char*>(&dt[0]));
+    if (!data->options.output)
+        return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 
-    if (!dt.empty()) {
-        data->messages.push_back(Message{ Message::Type::Data, std::move(dt) });
+    std::string dt;
+    const uint64_t processStart = uv_hrtime();
+    data->processor.process(buffer, frame->header.blocksize, dt);
+    DecoderStats::add(data->stats.processNs, uv_hrtime() - processStart);
+    DecoderStats::add(data->stats.bytesOutput, dt.size());
+    GlobalMetrics::add(metrics.bytesOutput, dt.size());
+
+    if (!dt.empty() && data->requested)
+        --data->requested;
+    if (data->ring.attached()) {
+        data->writeRing(dt);
+    } else if (!dt.empty()) {
+        data->post(Message{ Message::Type::Data, std::move(dt), data->lastFedAt, decodedAt });
         uv_async_send(&data->async);
     }
 
@@ -214,28 +557,57 @@ void Data::metadataCallback(const FLAC__StreamDecoder *decoder, const FLAC__Stre
 {
     // printf("!!meta %d\n", metadata->type);
     Data* data = static_cast<Data*>(client_data);
-    if (metadata->type == FLAC__METADATA_TYPE_VORBIS_COMMENT) {
-        const auto& vorbis = metadata->data.vorbis_comment;
-        Metadata meta;
-        auto split = [&meta](const FLAC__StreamMetadata_VorbisComment_Entry& entry) {
-            const char* eq = static_cast<char*>(std::memchr(entry.entry, '=', entry.length));
-            if (eq == nullptr)
-                return;
-            const char* estr = reinterpret_cast<char*>(entry.entry);
-            meta.tags.push_back(std::make_pair(std::string(estr, eq),
-                                               std::string(eq + 1, estr + entry.length)));
-        };
-        uv_mutex_lock(&data->mutex);
-        split(vorbis.vendor_string);
-        for (uint32_t i = 0; i < vorbis.num_comments; ++i) {
-            split(vorbis.comments[i]);
+    if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
+        for (FLAC__byte b : metadata->data.stream_info.md5sum) {
+            if (b)
+                data->hasMd5 = true;
         }
-        data->messages.push_back(Message{ Message::Type::Metadata, std::move(meta) });
+    } else if (metadata->type == FLAC__METADATA_TYPE_VORBIS_COMMENT) {
+        Metadata meta;
+        // called from process_single, so the mutex is already held
+        meta.tags = Processor::parseTags(metadata->data.vorbis_comment);
+        data->processor.setTags(meta.tags);
+        data->post(Message{ Message::Type::Metadata, std::move(meta) });
         uv_async_send(&data->async);
-        uv_mutex_unlock(&data->mutex);
     }
 }
 
+// blocks the decoder thread while the ring is full, with the mutex held.
+// the reader has no way to wake us so this polls, close() and Feed()
+// signal the cond and cut the wait short
+void Data::writeRing(const std::string& pcm)
+{
+    enum { RingPoll = 1000000 }; // ns
+    size_t written = 0;
+    while (written < pcm.size() && !stopped) {
+        written += ring.write(pcm.data() + written, pcm.size() - written);
+        if (written < pcm.size()) {
+            const uint64_t waitStart = uv_hrtime();
+            uv_cond_timedwait(&cond, &mutex, RingPoll);
+            waitNs += uv_hrtime() - waitStart;
+        }
+    }
+}
+
+// same polling as writeRing, until the reader has consumed everything
+void Data::drainRing()
+{
+    enum { RingPoll = 1000000 }; // ns
+    while (ring.pending() && !stopped) {
+        const uint64_t waitStart = uv_hrtime();
+        uv_cond_timedwait(&cond, &mutex, RingPoll);
+        waitNs += uv_hrtime() - waitStart;
+    }
+}
+
+void Data::post(Message&& message)
+{
+    DecoderStats::raise(stats.messagesQueued, stats.messagesPeak, 1);
+    if (message.type == Message::Type::Data)
+        DecoderStats::raise(stats.pendingBytes, stats.pendingPeak, std::get<std::string>(message.data).size());
+    messages.push_back(std::move(message));
+}
+
 void Data::errorCallback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data)
 {
 }
@@ -246,64 +618,279 @@ void Data::flacThread(void* arg)
 
     uv_mutex_lock(&data->mutex);
     for (;;) {
-        if (!FLAC__stream_decoder_process_single(data->decoder)) {
+        // idle between streams, the decoder stays around for the next one
+        while (!data->running && !data->quit)
+            uv_cond_wait(&data->cond, &data->mutex);
+        if (data->quit)
+            break;
+        GlobalMetrics::add(GlobalMetrics::instance().activeThreads, 1);
+        data->decode();
+        GlobalMetrics::add(GlobalMetrics::instance().activeThreads, -1);
+        data->running = false;
+        uv_cond_broadcast(&data->idle);
+    }
+    uv_mutex_unlock(&data->mutex);
+}
+
+// runs one stream, called with the mutex held
+void Data::decode()
+{
+    for (;;) {
+        // pull mode, wait until js wants more
+        while (options.pull && !requested && !stopped)
+            uv_cond_wait(&cond, &mutex);
+        const uint64_t decodeStart = uv_hrtime();
+        const uint64_t framesBefore = DecoderStats::get(stats.frames);
+        waitNs = 0;
+        if (!FLAC__stream_decoder_process_single(decoder)) {
             // badness, not sure what to do yet
         }
+        uint64_t decodeNs = uv_hrtime() - decodeStart;
+        decodeNs -= std::min(waitNs, decodeNs);
+        DecoderStats::add(stats.decodeNs, decodeNs);
+        const uint64_t framesDecoded = DecoderStats::get(stats.frames) - framesBefore;
+        if (framesDecoded) {
+            GlobalMetrics::instance().frameDecode.record(decodeNs);
+            if (tracer) {
+                // wall time, the starved events nest inside
+                tracer->decoder.add(Tracer::Event{ "decode", 'X', decodeStart, uv_hrtime() - decodeStart,
+                                                   "frames", framesDecoded });
+            }
+        }
 
-        if (data->stopped)
+        if (stopped)
             break;
-        if (FLAC__stream_decoder_get_state(data->decoder) == FLAC__STREAM_DECODER_END_OF_STREAM) {
+        // past END_OF_STREAM are the fatal states, those end the stream too
+        // since Finish() waits for the End
+        const FLAC__StreamDecoderState state = FLAC__stream_decoder_get_state(decoder);
+        if (state >= FLAC__STREAM_DECODER_END_OF_STREAM) {
             // end of stream, send a done if we haven't and close the decoder
-            if (data->needsDone) {
-                data->needsDone = false;
-                data->messages.push_back(Message{ Message::Type::Done, std::string() });
+            std::string tail;
+            processor.flush(tail);
+            DecoderStats::add(stats.bytesOutput, tail.size());
+            GlobalMetrics::add(GlobalMetrics::instance().bytesOutput, tail.size());
+            if (ring.attached())
+                writeRing(tail);
+            else if (!tail.empty())
+                post(Message{ Message::Type::Data, std::move(tail) });
+            if (options.md5 && state == FLAC__STREAM_DECODER_END_OF_STREAM) {
+                // libFLAC compares the md5 in finish, begin() inits again
+                const bool md5Ok = FLAC__stream_decoder_finish(decoder);
+                if (hasMd5)
+                    md5Result = md5Ok ? "match" : "mismatch";
             }
-            data->messages.push_back(Message{ Message::Type::End, std::string() });
-            uv_async_send(&data->async);
+            if (!analyzers.empty() || options.md5) {
+                for (auto& analyzer : analyzers) {
+                    analyzer->finish();
+                }
+                post(Message{ Message::Type::Analysis, std::string() });
+            }
+            if (needsDone || needsDrain) {
+                needsDone = needsDrain = false;
+                post(Message{ Message::Type::Done, std::string() });
+            }
+            if (tracer)
+                post(Message{ Message::Type::Trace, std::string() });
+            post(Message{ Message::Type::End, std::string() });
+            uv_async_send(&async);
             break;
         }
     }
-    uv_mutex_unlock(&data->mutex);
+    // the reader drains what is left and stops
+    if (ring.attached())
+        ring.end();
 }
 
-void Data::close()
+// detaches the instance from its js handle, stopping the stream if it is
+// still running, and hands it back to the pool
+void Data::close(bool collected)
 {
-    if (!decoder)
+    if (!attached)
         return;
-
-    if (!--Data::openCount) {
-        Data::extName.Reset();
-    }
-
-    if (!stopped) {
-        uv_mutex_lock(&mutex);
-        stopped = true;
-        uv_cond_signal(&cond);
-        uv_mutex_unlock(&mutex);
-        uv_thread_join(&thread);
+    attached = false;
+
+    if (!collected) {
+        // the old handle stays around in js, make it a closed one
+        Nan::HandleScope scope;
+        v8::Local<v8::Object> handle = Nan::New(weak);
+        handle->SetPrivate(Nan::GetCurrentContext(), Nan::New(addon->extName), Nan::Null());
+        delete weak.ClearWeak<Nan::WeakCallbackInfo<Data> >();
     }
+    weak.Reset();
+    // the private key stays, closed handles are still looked up with it
+    GlobalMetrics::add(GlobalMetrics::instance().openDecoders, -1);
+    addon->open.erase(this);
+
+    uv_mutex_lock(&mutex);
+    stopped = true;
+    uv_cond_signal(&cond);
+    while (running)
+        uv_cond_wait(&idle, &mutex);
+    // whatever the stream still had queued is of no use to the next one
+    messages.clear();
+    inbuffers.clear();
+    uv_mutex_unlock(&mutex);
+    ring.detach();
+    options.ring.reset();
+    tracer.reset();
 
     context.Reset();
     callback.Reset();
+    analyzers.clear();
+    release();
+}
+
+void Data::release()
+{
+    if (addon->pool.size() >= addon->poolSize) {
+        destroy();
+        return;
+    }
+    uv_unref(reinterpret_cast<uv_handle_t*>(&async));
+    addon->pool.push_back(this);
+}
+
+void Data::destroy()
+{
+    uv_mutex_lock(&mutex);
+    quit = true;
+    uv_cond_signal(&cond);
+    uv_mutex_unlock(&mutex);
+    uv_thread_join(&thread);
+    GlobalMetrics::add(GlobalMetrics::instance().decoderThreads, -1);
 
     FLAC__stream_decoder_finish(decoder);
     FLAC__stream_decoder_delete(decoder);
-
     decoder = nullptr;
+
+    uv_close(reinterpret_cast<uv_handle_t*>(&async),
+             [](uv_handle_t* handle) { delete static_cast<Data*>(handle->data); });
 }
 
 void Data::weakCallback(const Nan::WeakCallbackInfo<Data> &data)
 {
-    Data* param = data.GetParameter();
-    param->close();
-    if (param->async.data) {
-        uv_close(reinterpret_cast<uv_handle_t*>(&param->async),
-                 [](uv_handle_t* handle) { delete static_cast<Data*>(handle->data); });
-    } else {
-        delete param;
+    data.GetParameter()->close(true);
+}
+
+// throws and returns false unless value is a handle returned by Open. a
+// closed handle gives a null data
+bool Data::fromHandle(AddonData* addon, v8::Local<v8::Value> value, Data** data)
+{
+    if (!value->IsObject()) {
+        Nan::ThrowError("Argument must be an object");
+        return false;
+    }
+
+    auto ctx = Nan::GetCurrentContext();
+    v8::Local<v8::Object> obj = v8::Local<v8::Object>::Cast(value);
+    if (!obj->HasPrivate(ctx, Nan::New(addon->extName)).ToChecked()) {
+        Nan::ThrowError("Argument must have an external");
+        return false;
+    }
+    v8::Local<v8::Value> extValue = obj->GetPrivate(ctx, Nan::New(addon->extName)).ToLocalChecked();
+    *data = extValue->IsExternal() ? static_cast<Data*>(v8::Local<v8::External>::Cast(extValue)->Value()) : nullptr;
+    return true;
+}
+
+// a snapshot of the stream counters
+v8::Local<v8::Value> Data::statsValue() const
+{
+    Nan::EscapableHandleScope scope;
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    auto set = [&](const char* name, const DecoderStats::Counter& counter) {
+        Nan::Set(obj, Nan::New(name).ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(DecoderStats::get(counter))));
+    };
+    set("bytesFed", stats.bytesFed);
+    set("bytesDecoded", stats.bytesDecoded);
+    set("inputQueued", stats.inputQueued);
+    set("inputPeak", stats.inputPeak);
+    set("starved", stats.starved);
+    set("frames", stats.frames);
+    set("samples", stats.samples);
+    set("decodeNs", stats.decodeNs);
+    set("processNs", stats.processNs);
+    set("bytesOutput", stats.bytesOutput);
+    set("messagesQueued", stats.messagesQueued);
+    set("messagesPeak", stats.messagesPeak);
+    set("pendingBytes", stats.pendingBytes);
+    set("pendingPeak", stats.pendingPeak);
+    set("wakeups", stats.wakeups);
+    set("deliverNs", stats.deliverNs);
+    return scope.Escape(obj);
+}
+
+// the js side of a message, undefined for Done, the final stats for End
+v8::Local<v8::Value> Data::messageValue(const Message& message)
+{
+    Nan::EscapableHandleScope scope;
+    switch (message.type) {
+    case Message::Type::Format: {
+        const auto& format = std::get<Format>(message.data);
+        if (addon->formatTemplate.IsEmpty()) {
+            static const char* names[] = { "sampleRate", "channels", "bitDepth" };
+            v8::Local<v8::ObjectTemplate> tpl = v8::ObjectTemplate::New(isolate);
+            for (int i = 0; i < 3; ++i) {
+                v8::Local<v8::String> key = internalize(isolate, names[i]);
+                addon->formatKeys[i].Reset(key);
+                tpl->Set(key, v8::Integer::New(isolate, 0));
+            }
+            addon->formatTemplate.Reset(tpl);
+        }
+        v8::Local<v8::Context> ctx = Nan::GetCurrentContext();
+        v8::Local<v8::Object> formatObj = Nan::New(addon->formatTemplate)->NewInstance(ctx).ToLocalChecked();
+        const uint32_t values[] = { format.sampleRate, format.channels, format.bitsPerSample };
+        for (int i = 0; i < 3; ++i)
+            formatObj->Set(ctx, Nan::New(addon->formatKeys[i]), v8::Integer::NewFromUnsigned(isolate, values[i])).Check();
+        return scope.Escape(formatObj); }
+    case Message::Type::Metadata: {
+        const auto& meta = std::get<Metadata>(message.data);
+        v8::Local<v8::Object> metaObj = v8::Object::New(isolate);
+        v8::Local<v8::Context> ctx = Nan::GetCurrentContext();
+        for (const auto& p : meta.tags) {
+            v8::Local<v8::String> value = v8::String::NewFromUtf8(isolate, p.second.c_str(), v8::NewStringType::kNormal, static_cast<int>(p.second.size())).ToLocalChecked();
+            metaObj->Set(ctx, addon->tagKey(p.first), value).Check();
+        }
+        return scope.Escape(metaObj); }
+    case Message::Type::Data:
+        return scope.Escape(dataValue(&message, &message + 1));
+    case Message::Type::Analysis: {
+        // the decoder thread is done with the analyzers by now
+        v8::Local<v8::Object> analysisObj = v8::Object::New(isolate);
+        for (const auto& analyzer : analyzers) {
+            Nan::Set(analysisObj, Nan::New(analyzer->name()).ToLocalChecked(), analyzer->result());
+        }
+        if (options.md5) {
+            Nan::Set(analysisObj, Nan::New("md5").ToLocalChecked(), Nan::New(md5Result).ToLocalChecked());
+        }
+        return scope.Escape(analysisObj); }
+    case Message::Type::End:
+        return scope.Escape(statsValue());
+    case Message::Type::Trace:
+        // js may have closed the stream from an earlier message
+        if (!tracer)
+            return scope.Escape(Nan::Undefined());
+        return scope.Escape(tracer->value());
+    default:
+        return scope.Escape(Nan::Undefined());
     }
 }
 
+// one Buffer holding the pcm of a run of Data messages
+v8::Local<v8::Value> Data::dataValue(const Message* begin, const Message* end)
+{
+    size_t size = 0;
+    for (auto it = begin; it != end; ++it)
+        size += std::get<std::string>(it->data).size();
+    v8::Local<v8::Object> bufferObj = Nan::NewBuffer(size).ToLocalChecked();
+    char* dst = node::Buffer::Data(bufferObj);
+    for (auto it = begin; it != end; ++it) {
+        const auto& str = std::get<std::string>(it->data);
+        memcpy(dst, &str[0], str.size());
+        dst += str.size();
+    }
+    return bufferObj;
+}
+
 void Data::asyncCallback(uv_async_t* handle)
 {
     Data* data = static_cast<Data*>(handle->data);
@@ -311,176 +898,165 @@ void Data::asyncCallback(uv_async_t* handle)
     uv_mutex_lock(&data->mutex);
     localMessages = std::move(data->messages);
     uv_mutex_unlock(&data->mutex);
+    // a send that raced with close
+    if (localMessages.empty())
+        return;
+
+    const uint64_t start = uv_hrtime();
+    uint64_t pending = 0;
+    for (const auto& message : localMessages) {
+        if (message.type == Data::Message::Type::Data)
+            pending += std::get<std::string>(message.data).size();
+    }
+    DecoderStats::sub(data->stats.messagesQueued, localMessages.size());
+    DecoderStats::sub(data->stats.pendingBytes, pending);
+    DecoderStats::add(data->stats.wakeups, 1);
+    if (data->tracer) {
+        for (const auto& message : localMessages) {
+            if (message.decodedAt) {
+                data->tracer->decodeToDeliver.record(start - std::min(message.decodedAt, start));
+                if (message.fedAt)
+                    data->tracer->feedToDeliver.record(start - std::min(message.fedAt, start));
+            }
+        }
+    }
+    GlobalMetrics::add(GlobalMetrics::instance().wakeups, 1);
+    // once End hands the instance back it may already run another stream
+    bool closed = false;
+    auto delivered = [&]() {
+        const uint64_t ns = uv_hrtime() - start;
+        DecoderStats::add(data->stats.deliverNs, ns);
+        if (data->tracer)
+            data->tracer->js.add(Tracer::Event{ "deliver", 'X', start, ns, "messages", localMessages.size() });
+    };
 
     Nan::HandleScope scope;
     v8::Local<v8::Context> context = v8::Local<v8::Context>::New(data->isolate, data->context);
     v8::Local<v8::Function> callback = v8::Local<v8::Function>::New(data->isolate, data->callback);
+    auto call = [&](Data::Message::Type type, v8::Local<v8::Value> value) {
+        v8::Local<v8::Value> values[] = { v8::Integer::New(data->isolate, to_underlying(type)), value };
+        const int argc = value->IsUndefined() ? 1 : 2;
+        if (callback->Call(context, callback, argc, values).IsEmpty()) {
+            Nan::ThrowError("Failed to call");
+        }
+    };
 
-    for (const auto& message : localMessages) {
-        switch (message.type) {
-        case Data::Message::Type::Format: {
-            const auto& format = std::get<Data::Format>(message.data);
-            v8::Local<v8::Object> formatObj = v8::Object::New(data->isolate);
-            formatObj->Set(v8::String::NewFromUtf8(data->isolate, "sampleRate"), v8::Integer::New(data->isolate, format.sampleRate));
-            formatObj->Set(v8::String::NewFromUtf8(data->isolate, "channels"), v8::Integer::New(data->isolate, format.channels));
-            formatObj->Set(v8::String::NewFromUtf8(data->isolate, "bitDepth"), v8::Integer::New(data->isolate, format.bitsPerSample));
-
-            std::vector<v8::Local<v8::Value> > values;
-            values.push_back(v8::Local<v8::Value>(v8::Integer::New(data->isolate, to_underlying(Data::Message::Type::Format))));
-            values.push_back(v8::Local<v8::Value>(std::move(formatObj)));
-            if (callback->Call(context, callback, values.size(), &values[0]).IsEmpty()) {
-                Nan::ThrowError("Failed to call");
-            }
-            break; }
-        case Data::Message::Type::Metadata: {
-            const auto& meta = std::get<Data::Metadata>(message.data);
-            v8::Local<v8::Object> metaObj = v8::Object::New(data->isolate);
-            for (const auto& p : meta.tags) {
-                metaObj->Set(v8::String::NewFromUtf8(data->isolate, p.first.c_str()),
-                             v8::String::NewFromUtf8(data->isolate, p.second.c_str()));
-            }
-
-            std::vector<v8::Local<v8::Value> > values;
-            values.push_back(v8::Local<v8::Value>(v8::Integer::New(data->isolate, to_underlying(Data::Message::Type::Metadata))));
-            values.push_back(v8::Local<v8::Value>(std::move(metaObj)));
-            if (callback->Call(context, callback, values.size(), &values[0]).IsEmpty()) {
-                Nan::ThrowError("Failed to call");
+    if (data->options.batch) {
+        // consecutive Data messages become one Buffer
+        v8::Local<v8::Array> batch = Nan::New<v8::Array>();
+        uint32_t idx = 0;
+        for (auto it = localMessages.cbegin(); it != localMessages.cend();) {
+            v8::Local<v8::Value> value;
+            auto next = it + 1;
+            if (it->type == Data::Message::Type::Data) {
+                while (next != localMessages.cend() && next->type == Data::Message::Type::Data)
+                    ++next;
+                value = data->dataValue(&*it, &*it + (next - it));
+            } else {
+                value = data->messageValue(*it);
             }
-            break; }
-        case Data::Message::Type::Data: {
-            const auto& str = std::get<std::string>(message.data);
-            v8::Local<v8::Object> bufferObj = Nan::NewBuffer(str.size()).ToLocalChecked();
-            {
-                char* data = node::Buffer::Data(bufferObj);
-                memcpy(data, &str[0], str.size());
+            if (it->type == Data::Message::Type::End) {
+                // decoder end, the instance goes back to the pool
+                data->close();
+                closed = true;
             }
+            Nan::Set(batch, idx++, v8::Integer::New(data->isolate, to_underlying(it->type)));
+            Nan::Set(batch, idx++, value);
+            it = next;
+        }
+        call(Data::Message::Type::Batch, batch);
+        if (!closed)
+            delivered();
+        return;
+    }
 
-            std::vector<v8::Local<v8::Value> > values;
-            values.push_back(v8::Local<v8::Value>(v8::Integer::New(data->isolate, to_underlying(Data::Message::Type::Data))));
-            values.push_back(v8::Local<v8::Value>(std::move(bufferObj)));
-            if (callback->Call(context, callback, values.size(), &values[0]).IsEmpty()) {
-                Nan::ThrowError("Failed to call");
-            }
-            break; }
-        case Data::Message::Type::Done: {
-            v8::Local<v8::Value> done = v8::Integer::New(data->isolate, to_underlying(message.type));
-            if (callback->Call(context, callback, 1, &done).IsEmpty()) {
-                Nan::ThrowError("Failed to call");
-            }
-            break; }
-        case Data::Message::Type::End: {
-            // decoder end and thread dead. join and stuff.
+    const uint64_t generation = data->generation;
+    for (const auto& message : localMessages) {
+        // js closed the stream from an earlier message, the rest is stale
+        if (!data->attached || data->generation != generation) {
+            closed = true;
+            break;
+        }
+        v8::Local<v8::Value> value = data->messageValue(message);
+        if (message.type == Data::Message::Type::End) {
+            // decoder end, the instance goes back to the pool
             data->close();
-
-            v8::Local<v8::Value> end = v8::Integer::New(data->isolate, to_underlying(message.type));
-            if (callback->Call(context, callback, 1, &end).IsEmpty()) {
-                Nan::ThrowError("Failed to call");
-            }
-            break; }
+            closed = true;
         }
+        call(message.type, value);
     }
+    if (!closed && data->attached && data->generation == generation)
+        delivered();
 }
 
 NAN_METHOD(Open) {
-    Data* data = new Data;
-    data->isolate = info.GetIsolate();
     if (!info[0]->IsFunction()) {
         Nan::ThrowError("Argument must be a function");
         return;
     }
-    data->context.Reset(Nan::GetCurrentContext());
-    data->callback.Reset(v8::Local<v8::Function>::Cast(info[0]));
-
-    data->decoder = FLAC__stream_decoder_new();
-    if (data->decoder == nullptr) {
-        Nan::ThrowError("Unable to create decoder");
-        return;
-    }
-
-    if (FLAC__stream_decoder_init_stream(data->decoder,
-                                         data->readCallback,
-                                         nullptr,
-                                         nullptr,
-                                         nullptr,
-                                         nullptr,
-                                         data->writeCallback,
-                                         data->metadataCallback,
-                                         data->errorCallback,
-                                         data) != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
-        Nan::ThrowError("Failed to initialize flac stream");
+    Data::Options options;
+    if (!Data::parseOptions(info[1], &options))
         return;
+    std::vector<std::unique_ptr<Analyzer> > analyzers;
+    if (info[1]->IsObject()) {
+        v8::Local<v8::Value> analyze = Nan::Get(v8::Local<v8::Object>::Cast(info[1]), Nan::New("analyze").ToLocalChecked()).ToLocalChecked();
+        if (!createAnalyzers(analyze, analyzers))
+            return;
     }
 
-    if (uv_async_init(uv_default_loop(), &data->async, data->asyncCallback) < 0) {
-        FLAC__stream_decoder_finish(data->decoder);
-        FLAC__stream_decoder_delete(data->decoder);
-        Nan::ThrowError("Failed to init async handle");
+    AddonData* addon = AddonData::fromInfo(info);
+    Data* data = Data::acquire(addon);
+    if (!data)
         return;
-    }
-    data->async.data = data;
-
-    if (uv_thread_create(&data->thread, data->flacThread, data) < 0) {
-        FLAC__stream_decoder_finish(data->decoder);
-        FLAC__stream_decoder_delete(data->decoder);
-        uv_cond_destroy(&data->cond);
-        uv_mutex_destroy(&data->mutex);
-        Nan::ThrowError("Failed to init thread");
+    data->isolate = info.GetIsolate();
+    data->options = options;
+    data->analyzers = std::move(analyzers);
+    uv_mutex_lock(&data->mutex);
+    const bool ok = data->begin();
+    uv_mutex_unlock(&data->mutex);
+    if (!ok) {
+        data->analyzers.clear();
+        data->release();
+        Nan::ThrowError("Failed to initialize flac stream");
         return;
     }
+    data->context.Reset(Nan::GetCurrentContext());
+    data->callback.Reset(v8::Local<v8::Function>::Cast(info[0]));
 
     auto ctx = Nan::GetCurrentContext();
     v8::Local<v8::External> ext = v8::External::New(data->isolate, data);
     v8::Local<v8::Object> weak = v8::Object::New(data->isolate);
-    v8::Local<v8::Private> extName;
-    if (Data::extName.IsEmpty()) {
-        extName = v8::Private::New(data->isolate, v8::String::NewFromUtf8(data->isolate, "ext"));
-        Data::extName.Reset(extName);
-    } else {
-        extName = v8::Local<v8::Private>::New(data->isolate, Data::extName);
-    }
-    ++Data::openCount;
-    weak->SetPrivate(ctx, extName, ext);
+    GlobalMetrics& metrics = GlobalMetrics::instance();
+    GlobalMetrics::add(metrics.openDecoders, 1);
+    GlobalMetrics::add(metrics.streams, 1);
+    addon->open.insert(data);
+    weak->SetPrivate(ctx, Nan::New(addon->extName), ext);
     data->weak.Reset(weak);
     data->weak.SetWeak(data, Data::weakCallback, Nan::WeakCallbackType::kParameter);
+    data->attached = true;
+    uv_ref(reinterpret_cast<uv_handle_t*>(&data->async));
+
+    uv_mutex_lock(&data->mutex);
+    data->running = true;
+    uv_cond_signal(&data->cond);
+    uv_mutex_unlock(&data->mutex);
+
     info.GetReturnValue().Set(weak);
 }
 
 NAN_METHOD(Close) {
-    if (!info[0]->IsObject()) {
-        Nan::ThrowError("Argument must be an object");
-        return;
-    }
-
-    auto iso = info.GetIsolate();
-    auto ctx = Nan::GetCurrentContext();
-    v8::Local<v8::Object> obj = v8::Local<v8::Object>::Cast(info[0]);
-    v8::Local<v8::Private> extName = v8::Local<v8::Private>::New(iso, Data::extName);
-    if (!obj->HasPrivate(ctx, extName).ToChecked()) {
-        Nan::ThrowError("Argument must have an external");
+    Data* data;
+    if (!Data::fromHandle(AddonData::fromInfo(info), info[0], &data))
         return;
-    }
-    v8::Local<v8::Value> extValue = obj->GetPrivate(ctx, extName).ToLocalChecked();
-    Data* data = static_cast<Data*>(v8::Local<v8::External>::Cast(extValue)->Value());
-    data->close();
+    if (data)
+        data->close();
 }
 
 NAN_METHOD(Feed) {
-    if (!info[0]->IsObject()) {
-        Nan::ThrowError("Argument must be an object");
-        return;
-    }
-
-    auto iso = info.GetIsolate();
-    auto ctx = Nan::GetCurrentContext();
-    v8::Local<v8::Object> obj = v8::Local<v8::Object>::Cast(info[0]);
-    v8::Local<v8::Private> extName = v8::Local<v8::Private>::New(iso, Data::extName);
-    if (!obj->HasPrivate(ctx, extName).ToChecked()) {
-        Nan::ThrowError("Argument must have an external");
+    Data* data;
+    if (!Data::fromHandle(AddonData::fromInfo(info), info[0], &data))
         return;
-    }
-    v8::Local<v8::Value> extValue = obj->GetPrivate(ctx, extName).ToLocalChecked();
-    Data* data = static_cast<Data*>(v8::Local<v8::External>::Cast(extValue)->Value());
-    if (!data->decoder) {
+    if (!data) {
         Nan::ThrowError("Decoder not open");
         return;
     }
@@ -493,23 +1069,131 @@ NAN_METHOD(Feed) {
     const char* dt = node::Buffer::Data(info[1]);
     const size_t size = node::Buffer::Length(info[1]);
 
-    if (!size)
+    // true: js can feed more right away, false: wait for a Done
+    if (!size) {
+        info.GetReturnValue().Set(true);
         return;
+    }
 
     // printf("feeding %zu\n", size);
 
+    uint64_t fedAt = 0;
+    if (data->tracer) {
+        fedAt = uv_hrtime();
+        data->tracer->js.add(Tracer::Event{ "feed", 'i', fedAt, 0, "bytes", size });
+    }
+
     uv_mutex_lock(&data->mutex);
-    data->inbuffers.push_back(Data::BufferData{ 0, std::string(dt, size) });
+    data->inbuffers.push_back(Data::BufferData{ 0, std::string(dt, size), fedAt });
+    data->queued += size;
+    DecoderStats::add(data->stats.bytesFed, size);
+    GlobalMetrics::add(GlobalMetrics::instance().bytesFed, size);
+    DecoderStats::raise(data->stats.inputQueued, data->stats.inputPeak, size);
+    const size_t budget = data->options.inputBudget;
+    const bool accepted = budget && data->queued < budget;
+    if (budget && !accepted)
+        data->needsDrain = true;
     uv_cond_signal(&data->cond);
     uv_mutex_unlock(&data->mutex);
 
+    info.GetReturnValue().Set(accepted);
     // printf("fed\n");
 }
 
+// the counters of a running stream, undefined once it is closed. they are
+// read without the stream mutex, the decoder thread holds it while decoding
+NAN_METHOD(Stats) {
+    Data* data;
+    if (!Data::fromHandle(AddonData::fromInfo(info), info[0], &data))
+        return;
+    if (data)
+        info.GetReturnValue().Set(data->statsValue());
+}
+
+// the latency histograms and trace events of a running stream opened with
+// trace, undefined otherwise
+NAN_METHOD(Trace) {
+    Data* data;
+    if (!Data::fromHandle(AddonData::fromInfo(info), info[0], &data))
+        return;
+    if (data && data->tracer)
+        info.GetReturnValue().Set(data->tracer->value());
+}
+
+// no more input, the decoder finishes what is queued and ends the stream
+// with the usual Analysis, Done and End messages
+NAN_METHOD(Finish) {
+    Data* data;
+    if (!Data::fromHandle(AddonData::fromInfo(info), info[0], &data))
+        return;
+    if (!data)
+        return;
+
+    uv_mutex_lock(&data->mutex);
+    data->eof = true;
+    uv_cond_signal(&data->cond);
+    uv_mutex_unlock(&data->mutex);
+}
+
+// pull mode, lets the decoder produce count more pcm chunks
+NAN_METHOD(Request) {
+    Data* data;
+    if (!Data::fromHandle(AddonData::fromInfo(info), info[0], &data))
+        return;
+    if (!data) {
+        Nan::ThrowError("Decoder not open");
+        return;
+    }
+    if (!info[1]->IsNumber()) {
+        Nan::ThrowError("Request needs a count");
+        return;
+    }
+    const uint32_t count = Nan::To<uint32_t>(info[1]).FromJust();
+
+    uv_mutex_lock(&data->mutex);
+    data->requested += count;
+    uv_cond_signal(&data->cond);
+    uv_mutex_unlock(&data->mutex);
+}
+
+// how many idle decoders to keep warm, shrinking it frees the extra ones
+NAN_METHOD(SetPoolSize) {
+    // IsUint32 turns away negatives and fractions that To<uint32_t> would wrap or cut
+    if (!info[0]->IsUint32()) {
+        Nan::ThrowError("Pool size must be a non-negative integer");
+        return;
+    }
+    AddonData* addon = AddonData::fromInfo(info);
+    addon->poolSize = Nan::To<uint32_t>(info[0]).FromJust();
+    while (addon->pool.size() > addon->poolSize) {
+        Data* data = addon->pool.back();
+        addon->pool.pop_back();
+        data->destroy();
+    }
+}
+
+// loaded once per environment, worker threads included
 NAN_MODULE_INIT(Initialize) {
-    NAN_EXPORT(target, Open);
-    NAN_EXPORT(target, Feed);
-    NAN_EXPORT(target, Close);
+    v8::Isolate* isolate = v8::Isolate::GetCurrent();
+    AddonData* addon = new AddonData(isolate);
+    node::AddEnvironmentCleanupHook(isolate, AddonData::cleanup, addon);
+
+    v8::Local<v8::External> ext = v8::External::New(isolate, addon);
+    auto method = [&](const char* name, Nan::FunctionCallback fn) {
+        v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(fn, ext);
+        Nan::Set(target, Nan::New(name).ToLocalChecked(), Nan::GetFunction(tpl).ToLocalChecked());
+    };
+    method("Open", Open);
+    method("Feed", Feed);
+    method("Finish", Finish);
+    method("Close", Close);
+    method("Request", Request);
+    method("Stats", Stats);
+    method("Trace", Trace);
+    method("Metrics", Metrics);
+    method("Analyze", Analyze);
+    method("DecodeFile", DecodeFile);
+    method("SetPoolSize", SetPoolSize);
 }
 
-NODE_MODULE(flac, Initialize)
+NAN_MODULE_WORKER_ENABLED(flac, Initialize)
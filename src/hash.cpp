@@ -0,0 +1,348 @@
+#include "hash.h"
+#include <algorithm>
+#include <cstring>
+
+static inline uint32_t load32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static inline uint64_t load64(const unsigned char* p)
+{
+    return load32(p) | (static_cast<uint64_t>(load32(p + 4)) << 32);
+}
+
+static inline uint32_t rotr32(uint32_t v, unsigned n)
+{
+    return (v >> n) | (v << (32 - n));
+}
+
+static inline uint64_t rotl64(uint64_t v, unsigned n)
+{
+    return (v << n) | (v >> (64 - n));
+}
+
+static std::string hex(const unsigned char* bytes, size_t size)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string out(size * 2, '0');
+    for (size_t i = 0; i < size; ++i) {
+        out[i * 2] = digits[bytes[i] >> 4];
+        out[i * 2 + 1] = digits[bytes[i] & 0xf];
+    }
+    return out;
+}
+
+// XXH64 with seed 0
+class Xxh64 : public Hash
+{
+public:
+    Xxh64()
+        : total(0), fill(0)
+    {
+        acc[0] = prime1 + prime2;
+        acc[1] = prime2;
+        acc[2] = 0;
+        acc[3] = -prime1;
+    }
+
+    void update(const unsigned char* data, size_t size) override
+    {
+        total += size;
+        if (fill) {
+            const size_t take = std::min(size, sizeof(buffer) - fill);
+            memcpy(buffer + fill, data, take);
+            fill += take;
+            data += take;
+            size -= take;
+            if (fill < sizeof(buffer))
+                return;
+            stripe(buffer);
+            fill = 0;
+        }
+        for (; size >= 32; data += 32, size -= 32)
+            stripe(data);
+        memcpy(buffer, data, size);
+        fill = size;
+    }
+
+    std::string digest() const override
+    {
+        uint64_t h;
+        if (total >= 32) {
+            h = rotl64(acc[0], 1) + rotl64(acc[1], 7) + rotl64(acc[2], 12) + rotl64(acc[3], 18);
+            for (uint64_t a : acc)
+                h = (h ^ round(0, a)) * prime1 + prime4;
+        } else {
+            h = prime5;
+        }
+        h += total;
+
+        const unsigned char* p = buffer;
+        size_t left = fill;
+        for (; left >= 8; p += 8, left -= 8)
+            h = rotl64(h ^ round(0, load64(p)), 27) * prime1 + prime4;
+        if (left >= 4) {
+            h = rotl64(h ^ (load32(p) * prime1), 23) * prime2 + prime3;
+            p += 4;
+            left -= 4;
+        }
+        for (; left; ++p, --left)
+            h = rotl64(h ^ (*p * prime5), 11) * prime1;
+
+        h ^= h >> 33;
+        h *= prime2;
+        h ^= h >> 29;
+        h *= prime3;
+        h ^= h >> 32;
+
+        unsigned char bytes[8];
+        for (int i = 0; i < 8; ++i)
+            bytes[i] = static_cast<unsigned char>(h >> (56 - i * 8));
+        return hex(bytes, sizeof(bytes));
+    }
+
+private:
+    static constexpr uint64_t prime1 = 0x9E3779B185EBCA87ULL, prime2 = 0xC2B2AE3D27D4EB4FULL,
+        prime3 = 0x165667B19E3779F9ULL, prime4 = 0x85EBCA77C2B2AE63ULL, prime5 = 0x27D4EB2F165667C5ULL;
+
+    static inline uint64_t round(uint64_t a, uint64_t input)
+    {
+        return rotl64(a + input * prime2, 31) * prime1;
+    }
+
+    void stripe(const unsigned char* p)
+    {
+        for (int i = 0; i < 4; ++i)
+            acc[i] = round(acc[i], load64(p + i * 8));
+    }
+
+    uint64_t acc[4];
+    uint64_t total;
+    unsigned char buffer[32];
+    size_t fill;
+};
+
+// BLAKE3 in its default hash mode with a 32 byte output, a port of the
+// portable reference implementation
+class Blake3 : public Hash
+{
+public:
+    Blake3()
+        : stackSize(0)
+    {
+        memcpy(key, iv, sizeof(key));
+        chunk.reset(key, 0);
+    }
+
+    void update(const unsigned char* data, size_t size) override
+    {
+        while (size) {
+            if (chunk.length() == chunkLength) {
+                uint32_t cv[8];
+                chunk.output().chainingValue(cv);
+                const uint64_t chunks = chunk.counter + 1;
+                addChunk(cv, chunks);
+                chunk.reset(key, chunks);
+            }
+            const size_t take = std::min<size_t>(chunkLength - chunk.length(), size);
+            chunk.update(data, take);
+            data += take;
+            size -= take;
+        }
+    }
+
+    std::string digest() const override
+    {
+        Output output = chunk.output();
+        for (size_t i = stackSize; i > 0; --i) {
+            uint32_t cv[8];
+            output.chainingValue(cv);
+            output = parent(stack[i - 1], cv);
+        }
+        uint32_t words[16];
+        compress(output.cv, output.block, 0, output.blockLength, output.flags | root, words);
+        unsigned char bytes[32];
+        for (int i = 0; i < 8; ++i) {
+            for (int b = 0; b < 4; ++b)
+                bytes[i * 4 + b] = static_cast<unsigned char>(words[i] >> (b * 8));
+        }
+        return hex(bytes, sizeof(bytes));
+    }
+
+private:
+    enum { chunkStart = 1, chunkEnd = 2, parentNode = 4, root = 8 };
+    static constexpr size_t blockLength = 64, chunkLength = 1024;
+    static const uint32_t iv[8];
+
+    static void compress(const uint32_t cv[8], const uint32_t block[16], uint64_t counter,
+                         uint32_t length, uint32_t flags, uint32_t out[16])
+    {
+        static const unsigned permutation[16] = { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 };
+        uint32_t s[16] = {
+            cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+            iv[0], iv[1], iv[2], iv[3],
+            static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32), length, flags
+        };
+        uint32_t m[16];
+        memcpy(m, block, sizeof(m));
+        auto g = [&s](int a, int b, int c, int d, uint32_t x, uint32_t y) {
+            s[a] = s[a] + s[b] + x;
+            s[d] = rotr32(s[d] ^ s[a], 16);
+            s[c] = s[c] + s[d];
+            s[b] = rotr32(s[b] ^ s[c], 12);
+            s[a] = s[a] + s[b] + y;
+            s[d] = rotr32(s[d] ^ s[a], 8);
+            s[c] = s[c] + s[d];
+            s[b] = rotr32(s[b] ^ s[c], 7);
+        };
+        for (int r = 0; r < 7; ++r) {
+            g(0, 4, 8, 12, m[0], m[1]);
+            g(1, 5, 9, 13, m[2], m[3]);
+            g(2, 6, 10, 14, m[4], m[5]);
+            g(3, 7, 11, 15, m[6], m[7]);
+            g(0, 5, 10, 15, m[8], m[9]);
+            g(1, 6, 11, 12, m[10], m[11]);
+            g(2, 7, 8, 13, m[12], m[13]);
+            g(3, 4, 9, 14, m[14], m[15]);
+            uint32_t p[16];
+            for (int i = 0; i < 16; ++i)
+                p[i] = m[permutation[i]];
+            memcpy(m, p, sizeof(m));
+        }
+        for (int i = 0; i < 8; ++i) {
+            out[i] = s[i] ^ s[i + 8];
+            out[i + 8] = s[i + 8] ^ cv[i];
+        }
+    }
+
+    struct Output
+    {
+        uint32_t cv[8];
+        uint32_t block[16];
+        uint64_t counter;
+        uint32_t blockLength;
+        uint32_t flags;
+
+        void chainingValue(uint32_t out[8]) const
+        {
+            uint32_t words[16];
+            compress(cv, block, counter, blockLength, flags, words);
+            memcpy(out, words, 8 * sizeof(uint32_t));
+        }
+    };
+
+    struct Chunk
+    {
+        uint32_t cv[8];
+        uint64_t counter;
+        unsigned char block[blockLength];
+        size_t blockFill;
+        unsigned blocksCompressed;
+
+        void reset(const uint32_t key[8], uint64_t chunkCounter)
+        {
+            memcpy(cv, key, sizeof(cv));
+            counter = chunkCounter;
+            memset(block, '\0', sizeof(block));
+            blockFill = 0;
+            blocksCompressed = 0;
+        }
+
+        size_t length() const { return blocksCompressed * blockLength + blockFill; }
+        uint32_t startFlag() const { return blocksCompressed ? 0 : chunkStart; }
+
+        void words(uint32_t out[16]) const
+        {
+            for (int i = 0; i < 16; ++i)
+                out[i] = load32(block + i * 4);
+        }
+
+        void update(const unsigned char* data, size_t size)
+        {
+            while (size) {
+                if (blockFill == blockLength) {
+                    uint32_t w[16], out[16];
+                    words(w);
+                    compress(cv, w, counter, blockLength, startFlag(), out);
+                    memcpy(cv, out, sizeof(cv));
+                    ++blocksCompressed;
+                    memset(block, '\0', sizeof(block));
+                    blockFill = 0;
+                }
+                const size_t take = std::min(blockLength - blockFill, size);
+                memcpy(block + blockFill, data, take);
+                blockFill += take;
+                data += take;
+                size -= take;
+            }
+        }
+
+        Output output() const
+        {
+            Output out;
+            memcpy(out.cv, cv, sizeof(cv));
+            words(out.block);
+            out.counter = counter;
+            out.blockLength = static_cast<uint32_t>(blockFill);
+            out.flags = startFlag() | chunkEnd;
+            return out;
+        }
+    };
+
+    Output parent(const uint32_t left[8], const uint32_t right[8]) const
+    {
+        Output out;
+        memcpy(out.cv, key, sizeof(key));
+        memcpy(out.block, left, 8 * sizeof(uint32_t));
+        memcpy(out.block + 8, right, 8 * sizeof(uint32_t));
+        out.counter = 0;
+        out.blockLength = blockLength;
+        out.flags = parentNode;
+        return out;
+    }
+
+    // merges completed subtrees, one per trailing zero bit of the chunk count
+    void addChunk(uint32_t cv[8], uint64_t chunks)
+    {
+        while (!(chunks & 1)) {
+            parent(stack[--stackSize], cv).chainingValue(cv);
+            chunks >>= 1;
+        }
+        memcpy(stack[stackSize++], cv, 8 * sizeof(uint32_t));
+    }
+
+    uint32_t key[8];
+    Chunk chunk;
+    uint32_t stack[54][8];
+    size_t stackSize;
+};
+
+const uint32_t Blake3::iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+std::unique_ptr<Hash> Hash::create(Algorithm algorithm)
+{
+    if (algorithm == Algorithm::Blake3)
+        return std::make_unique<Blake3>();
+    return std::make_unique<Xxh64>();
+}
+
+bool Hash::parseAlgorithm(const char* name, Algorithm* algorithm)
+{
+    if (!strcmp(name, "xxh64")) {
+        *algorithm = Algorithm::Xxh64;
+        return true;
+    }
+    if (!strcmp(name, "blake3")) {
+        *algorithm = Algorithm::Blake3;
+        return true;
+    }
+    return false;
+}
+
+const char* Hash::algorithmName(Algorithm algorithm)
+{
+    return algorithm == Algorithm::Blake3 ? "blake3" : "xxh64";
+}
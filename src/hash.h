@@ -0,0 +1,26 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// incremental content hashes, portable implementations
+class Hash
+{
+public:
+    enum class Algorithm { Xxh64, Blake3 };
+
+    virtual ~Hash() {}
+
+    virtual void update(const unsigned char* data, size_t size) = 0;
+    // lowercase hex digest of everything passed to update
+    virtual std::string digest() const = 0;
+
+    static std::unique_ptr<Hash> create(Algorithm algorithm);
+    static bool parseAlgorithm(const char* name, Algorithm* algorithm);
+    static const char* algorithmName(Algorithm algorithm);
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include "loudness.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const double pi = 3.14159265358979323846;
+static const double absoluteGate = -70.;
+
+static inline double loudness(double energy)
+{
+    if (energy <= 0.)
+        return -std::numeric_limits<double>::infinity();
+    return -0.691 + 10. * std::log10(energy);
+}
+
+// BS.1770 channel weights for the FLAC channel orders, the LFE is left out
+// and the surround channels get +1.5dB
+static double channelWeight(uint32_t channels, uint32_t channel)
+{
+    static const double s = 1.41;
+    switch (channels) {
+    case 4: {   // L R BL BR
+        static const double w[] = { 1, 1, s, s };
+        return w[channel]; }
+    case 5: {   // L R C BL BR
+        static const double w[] = { 1, 1, 1, s, s };
+        return w[channel]; }
+    case 6: {   // L R C LFE BL BR
+        static const double w[] = { 1, 1, 1, 0, s, s };
+        return w[channel]; }
+    case 7: {   // L R C LFE BC SL SR
+        static const double w[] = { 1, 1, 1, 0, s, s, s };
+        return w[channel]; }
+    case 8: {   // L R C LFE BL BR SL SR
+        static const double w[] = { 1, 1, 1, 0, s, s, s, s };
+        return w[channel]; }
+    default:
+        return 1.;
+    }
+}
+
+LoudnessAnalyzer::LoudnessAnalyzer(bool series)
+    : keepSeries(series), sampleRate(0), scale(1.f), blockSize(0), blockFill(0),
+      oversampling(1), samplePeak(0.f), truePeak(0.f),
+      integrated(0.), range(0.), momentaryMax(0.), shortTermMax(0.)
+{
+    memset(&shelf, '\0', sizeof(shelf));
+    memset(&highpass, '\0', sizeof(highpass));
+}
+
+void LoudnessAnalyzer::format(uint32_t rate, uint32_t count, uint32_t bitsPerSample)
+{
+    sampleRate = rate;
+    scale = 1.f / static_cast<float>(1u << (bitsPerSample - 1));
+
+    // K-weighting pre-filter, the BS.1770 48kHz coefficients re-derived for
+    // the actual sample rate
+    {
+        const double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+        const double k = std::tan(pi * f0 / rate);
+        const double vh = std::pow(10., gain / 20.);
+        const double vb = std::pow(vh, 0.4996667741545416);
+        const double a0 = 1. + k / q + k * k;
+        shelf.b0 = (vh + vb * k / q + k * k) / a0;
+        shelf.b1 = 2. * (k * k - vh) / a0;
+        shelf.b2 = (vh - vb * k / q + k * k) / a0;
+        shelf.a1 = 2. * (k * k - 1.) / a0;
+        shelf.a2 = (1. - k / q + k * k) / a0;
+    }
+    {
+        const double f0 = 38.13547087602444, q = 0.5003270373238773;
+        const double k = std::tan(pi * f0 / rate);
+        const double a0 = 1. + k / q + k * k;
+        highpass.b0 = 1.;
+        highpass.b1 = -2.;
+        highpass.b2 = 1.;
+        highpass.a1 = 2. * (k * k - 1.) / a0;
+        highpass.a2 = (1. - k / q + k * k) / a0;
+    }
+
+    channels.assign(count, Channel());
+    for (uint32_t c = 0; c < count; ++c) {
+        memset(&channels[c], '\0', sizeof(Channel));
+        channels[c].weight = channelWeight(count, c);
+    }
+
+    blockSize = std::max(1u, rate / 10);
+    blockFill = 0;
+    blocks.clear();
+    momentary.clear();
+    shortTerm.clear();
+
+    // 4x oversampling for true peak below 96kHz, 2x below 192kHz
+    oversampling = rate < 96000 ? 4 : rate < 192000 ? 2 : 1;
+    upsampler.init(rate, rate * oversampling, count, Resampler::Quality::Fast);
+    samplePeak = truePeak = 0.f;
+}
+
+void LoudnessAnalyzer::process(const FLAC__int32* const buffer[], unsigned samples)
+{
+    unsigned offset = 0;
+    while (offset < samples) {
+        const unsigned run = std::min(samples - offset, blockSize - blockFill);
+        for (size_t c = 0; c < channels.size(); ++c) {
+            Channel& ch = channels[c];
+            const FLAC__int32* src = buffer[c] + offset;
+            double s1 = ch.z1[0], s2 = ch.z2[0], t1 = ch.z1[1], t2 = ch.z2[1];
+            double sum = 0.;
+            for (unsigned i = 0; i < run; ++i) {
+                const double x = src[i] * static_cast<double>(scale);
+                const double y = shelf.b0 * x + s1;
+                s1 = shelf.b1 * x - shelf.a1 * y + s2;
+                s2 = shelf.b2 * x - shelf.a2 * y;
+                const double z = highpass.b0 * y + t1;
+                t1 = highpass.b1 * y - highpass.a1 * z + t2;
+                t2 = highpass.b2 * y - highpass.a2 * z;
+                sum += z * z;
+            }
+            ch.z1[0] = s1;
+            ch.z2[0] = s2;
+            ch.z1[1] = t1;
+            ch.z2[1] = t2;
+            ch.sum += sum;
+        }
+        offset += run;
+        blockFill += run;
+        if (blockFill == blockSize)
+            endBlock();
+    }
+
+    const float* in[FLAC__MAX_CHANNELS];
+    for (size_t c = 0; c < channels.size(); ++c) {
+        auto& plane = planes[c];
+        plane.resize(samples);
+        int64_t peak = 0;
+        for (unsigned i = 0; i < samples; ++i) {
+            plane[i] = buffer[c][i] * scale;
+            peak = std::max(peak, std::abs(static_cast<int64_t>(buffer[c][i])));
+        }
+        samplePeak = std::max(samplePeak, peak * scale);
+        in[c] = plane.data();
+    }
+    if (oversampling > 1) {
+        upsampler.process(in, samples, upsampled);
+        for (size_t c = 0; c < channels.size(); ++c) {
+            for (float v : upsampled[c])
+                truePeak = std::max(truePeak, std::fabs(v));
+            upsampled[c].clear();
+        }
+    }
+}
+
+void LoudnessAnalyzer::endBlock()
+{
+    double energy = 0.;
+    for (auto& ch : channels) {
+        energy += ch.weight * ch.sum / blockSize;
+        ch.sum = 0.;
+    }
+    blocks.push_back(energy);
+    blockFill = 0;
+
+    auto window = [this](size_t count) {
+        double sum = 0.;
+        for (size_t i = blocks.size() - count; i < blocks.size(); ++i)
+            sum += blocks[i];
+        return sum / count;
+    };
+    if (blocks.size() >= 4)
+        momentary.push_back(window(4));
+    if (blocks.size() >= 30)
+        shortTerm.push_back(window(30));
+}
+
+void LoudnessAnalyzer::finish()
+{
+    const double none = -std::numeric_limits<double>::infinity();
+
+    // the upsampler isn't flushed, cutting the stream off against silence
+    // would ring and read as a peak that isn't in the material
+    truePeak = std::max(truePeak, samplePeak);
+
+    momentaryMax = shortTermMax = none;
+    for (double e : momentary)
+        momentaryMax = std::max(momentaryMax, loudness(e));
+    for (double e : shortTerm)
+        shortTermMax = std::max(shortTermMax, loudness(e));
+
+    // integrated loudness, gated at -70 LUFS and then at -10 LU below the
+    // mean of what passed the absolute gate
+    auto gatedMean = [](const std::vector<double>& energies, double gate) {
+        double sum = 0.;
+        size_t count = 0;
+        for (double e : energies) {
+            if (loudness(e) > gate) {
+                sum += e;
+                ++count;
+            }
+        }
+        return count ? sum / count : 0.;
+    };
+    const double relative = loudness(gatedMean(momentary, absoluteGate)) - 10.;
+    integrated = loudness(gatedMean(momentary, std::max(absoluteGate, relative)));
+
+    // loudness range, EBU Tech 3342: short-term values gated at -70 LUFS
+    // and -20 LU, the spread between the 10th and 95th percentile
+    const double rangeGate = std::max(absoluteGate, loudness(gatedMean(shortTerm, absoluteGate)) - 20.);
+    std::vector<double> values;
+    for (double e : shortTerm) {
+        const double l = loudness(e);
+        if (l > rangeGate)
+            values.push_back(l);
+    }
+    range = 0.;
+    if (!values.empty()) {
+        std::sort(values.begin(), values.end());
+        const size_t last = values.size() - 1;
+        range = values[static_cast<size_t>(last * .95 + .5)] - values[static_cast<size_t>(last * .1 + .5)];
+    }
+}
+
+v8::Local<v8::Value> LoudnessAnalyzer::result() const
+{
+    Nan::EscapableHandleScope scope;
+    auto db = [](float v) { return v > 0.f ? 20. * std::log10(v) : -std::numeric_limits<double>::infinity(); };
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, Nan::New("integrated").ToLocalChecked(), Nan::New<v8::Number>(integrated));
+    Nan::Set(obj, Nan::New("range").ToLocalChecked(), Nan::New<v8::Number>(range));
+    Nan::Set(obj, Nan::New("momentaryMax").ToLocalChecked(), Nan::New<v8::Number>(momentaryMax));
+    Nan::Set(obj, Nan::New("shortTermMax").ToLocalChecked(), Nan::New<v8::Number>(shortTermMax));
+    Nan::Set(obj, Nan::New("truePeak").ToLocalChecked(), Nan::New<v8::Number>(db(truePeak)));
+    Nan::Set(obj, Nan::New("samplePeak").ToLocalChecked(), Nan::New<v8::Number>(db(samplePeak)));
+    if (keepSeries) {
+        // LUFS every 100ms
+        auto series = [](const std::vector<double>& energies) {
+            std::vector<float> values;
+            values.reserve(energies.size());
+            for (double e : energies)
+                values.push_back(static_cast<float>(loudness(e)));
+            return toFloat32Array(values);
+        };
+        Nan::Set(obj, Nan::New("momentary").ToLocalChecked(), series(momentary));
+        Nan::Set(obj, Nan::New("shortTerm").ToLocalChecked(), series(shortTerm));
+    }
+    return scope.Escape(obj);
+}
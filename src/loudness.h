@@ -0,0 +1,58 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include "analyzer.h"
+#include "resampler.h"
+
+// EBU R128 / ITU-R BS.1770-4 loudness: integrated, momentary and short-term
+// loudness, loudness range and true peak
+class LoudnessAnalyzer : public Analyzer
+{
+public:
+    explicit LoudnessAnalyzer(bool series);
+
+    const char* name() const override { return "loudness"; }
+
+    void format(uint32_t sampleRate, uint32_t channels, uint32_t bitsPerSample) override;
+    void process(const FLAC__int32* const buffer[], unsigned samples) override;
+    void finish() override;
+
+    v8::Local<v8::Value> result() const override;
+
+private:
+    struct Biquad
+    {
+        double b0, b1, b2, a1, a2;
+    };
+
+    struct Channel
+    {
+        double weight;
+        double z1[2], z2[2];    // state of the two filter stages
+        double sum;             // filtered energy of the current 100ms block
+    };
+
+    void endBlock();
+
+    bool keepSeries;
+    uint32_t sampleRate;
+    float scale;
+    Biquad shelf, highpass;
+    std::vector<Channel> channels;
+
+    uint32_t blockSize, blockFill;
+    // weighted channel energy of every 100ms block
+    std::vector<double> blocks;
+    // energies of the 400ms and 3s windows, one per 100ms step
+    std::vector<double> momentary, shortTerm;
+
+    unsigned oversampling;
+    Resampler upsampler;
+    std::vector<float> planes[FLAC__MAX_CHANNELS];
+    std::vector<float> upsampled[FLAC__MAX_CHANNELS];
+    float samplePeak, truePeak;
+
+    double integrated, range, momentaryMax, shortTermMax;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "metrics.h"
+
+void Histogram::record(uint64_t ns)
+{
+    unsigned bucket = 0;
+    for (uint64_t v = (ns - (ns > 0)) >> MinShift; v && bucket < Buckets; v >>= 1)
+        ++bucket;
+    counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    n.fetch_add(1, std::memory_order_relaxed);
+    sumNs.fetch_add(ns, std::memory_order_relaxed);
+}
+
+void Histogram::reset()
+{
+    for (auto& count : counts)
+        count.store(0, std::memory_order_relaxed);
+    n.store(0, std::memory_order_relaxed);
+    sumNs.store(0, std::memory_order_relaxed);
+}
+
+v8::Local<v8::Object> Histogram::value() const
+{
+    Nan::EscapableHandleScope scope;
+    v8::Local<v8::Array> bounds = Nan::New<v8::Array>(Buckets);
+    v8::Local<v8::Array> values = Nan::New<v8::Array>(Buckets + 1);
+    for (unsigned i = 0; i < Buckets; ++i)
+        Nan::Set(bounds, i, Nan::New<v8::Number>(bound(i) / 1e9));
+    for (unsigned i = 0; i <= Buckets; ++i)
+        Nan::Set(values, i, Nan::New<v8::Number>(static_cast<double>(count(i))));
+
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, Nan::New("bounds").ToLocalChecked(), bounds);
+    Nan::Set(obj, Nan::New("counts").ToLocalChecked(), values);
+    Nan::Set(obj, Nan::New("sum").ToLocalChecked(), Nan::New<v8::Number>(sum() / 1e9));
+    Nan::Set(obj, Nan::New("count").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(total())));
+    return scope.Escape(obj);
+}
+
+GlobalMetrics::GlobalMetrics()
+    : openDecoders(0), decoderThreads(0), activeThreads(0),
+      streams(0), bytesFed(0), bytesDecoded(0), bytesOutput(0), frames(0), samples(0), wakeups(0),
+      start(uv_hrtime())
+{
+}
+
+GlobalMetrics& GlobalMetrics::instance()
+{
+    static GlobalMetrics metrics;
+    return metrics;
+}
+
+v8::Local<v8::Object> GlobalMetrics::snapshot() const
+{
+    Nan::EscapableHandleScope scope;
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    auto set = [&](const char* name, double value) {
+        Nan::Set(obj, Nan::New(name).ToLocalChecked(), Nan::New<v8::Number>(value));
+    };
+    auto get = [](const Counter& counter) {
+        return static_cast<double>(counter.load(std::memory_order_relaxed));
+    };
+    set("uptime", (uv_hrtime() - start) / 1e9);
+    set("openDecoders", static_cast<double>(openDecoders.load(std::memory_order_relaxed)));
+    set("decoderThreads", static_cast<double>(decoderThreads.load(std::memory_order_relaxed)));
+    set("activeThreads", static_cast<double>(activeThreads.load(std::memory_order_relaxed)));
+    set("streams", get(streams));
+    set("bytesFed", get(bytesFed));
+    set("bytesDecoded", get(bytesDecoded));
+    set("bytesOutput", get(bytesOutput));
+    set("frames", get(frames));
+    set("samples", get(samples));
+    set("wakeups", get(wakeups));
+    Nan::Set(obj, Nan::New("frameDecode").ToLocalChecked(), frameDecode.value());
+    return scope.Escape(obj);
+}
+
+NAN_METHOD(Metrics) {
+    info.GetReturnValue().Set(GlobalMetrics::instance().snapshot());
+}
@@ -0,0 +1,70 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <nan.h>
+#include <atomic>
+#include <cstdint>
+
+// latency histogram with log2 buckets, bucket i counts values up to
+// 2^(i + MinShift) ns and the last one everything above. lock free, any
+// thread can record while another snapshots
+class Histogram
+{
+public:
+    enum { MinShift = 10, Buckets = 22 }; // 1.024us to 2.1s
+
+    Histogram() { reset(); }
+
+    void record(uint64_t ns);
+    void reset();
+
+    static uint64_t bound(unsigned bucket) { return uint64_t(1) << (bucket + MinShift); }
+    uint64_t count(unsigned bucket) const { return counts[bucket].load(std::memory_order_relaxed); }
+    uint64_t total() const { return n.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sumNs.load(std::memory_order_relaxed); }
+
+    // { bounds, counts, sum, count } with the bounds in seconds and one
+    // more count than bounds for the overflow
+    v8::Local<v8::Object> value() const;
+
+private:
+    std::atomic<uint64_t> counts[Buckets + 1];
+    std::atomic<uint64_t> n, sumNs;
+};
+
+// counters over every FlacDecoder stream in the process, workers included.
+// only atomics, so it is the one piece of state the environments share
+struct GlobalMetrics
+{
+    typedef std::atomic<uint64_t> Counter;
+
+    static GlobalMetrics& instance();
+
+    // gauges
+    std::atomic<int64_t> openDecoders;    // attached to a stream
+    std::atomic<int64_t> decoderThreads;  // alive, pooled ones included
+    std::atomic<int64_t> activeThreads;   // decoding a stream right now
+
+    Counter streams;
+    Counter bytesFed;
+    Counter bytesDecoded;
+    Counter bytesOutput;
+    Counter frames;
+    Counter samples;
+    Counter wakeups;
+    Histogram frameDecode;
+
+    static void add(Counter& counter, uint64_t value) { counter.fetch_add(value, std::memory_order_relaxed); }
+    static void add(std::atomic<int64_t>& gauge, int64_t value) { gauge.fetch_add(value, std::memory_order_relaxed); }
+
+    v8::Local<v8::Object> snapshot() const;
+
+private:
+    GlobalMetrics();
+    uint64_t start;
+};
+
+// a snapshot of the process wide metrics
+NAN_METHOD(Metrics);
+
+#endif
@@ -0,0 +1,162 @@
+#include "mixer.h"
+#include <algorithm>
+#include <cstring>
+
+// -3dB, ITU-R BS.775 style fold down of centre and surround channels
+static const float c = 0.70710678f;
+
+// stereo fold down for the FLAC channel orders, indexed by channel count
+static const std::vector<std::vector<float> > stereoDownmix[] = {
+    {},
+    { { 1 },
+      { 1 } },
+    {},
+    // L R C
+    { { 1, 0, c },
+      { 0, 1, c } },
+    // L R BL BR
+    { { 1, 0, c, 0 },
+      { 0, 1, 0, c } },
+    // L R C BL BR
+    { { 1, 0, c, c, 0 },
+      { 0, 1, c, 0, c } },
+    // L R C LFE BL BR
+    { { 1, 0, c, 0, c, 0 },
+      { 0, 1, c, 0, 0, c } },
+    // L R C LFE BC SL SR
+    { { 1, 0, c, 0, c * c, c, 0 },
+      { 0, 1, c, 0, c * c, 0, c } },
+    // L R C LFE BL BR SL SR
+    { { 1, 0, c, 0, c, 0, c, 0 },
+      { 0, 1, c, 0, 0, c, 0, c } }
+};
+
+Mixer::Mixer()
+    : inChannels(0), outChannels(0), mixes(false), remaps(false)
+{
+}
+
+bool Mixer::parseDownmix(const char* name, Downmix* downmix)
+{
+    if (!strcmp(name, "none")) {
+        *downmix = Downmix::None;
+    } else if (!strcmp(name, "mono")) {
+        *downmix = Downmix::Mono;
+    } else if (!strcmp(name, "stereo")) {
+        *downmix = Downmix::Stereo;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void Mixer::configure(const Options& options, unsigned channels)
+{
+    inChannels = outChannels = channels;
+    mixes = remaps = false;
+    map.clear();
+    coefficients.clear();
+
+    if (!options.matrix.empty()) {
+        for (const auto& row : options.matrix) {
+            if (row.size() != inChannels)
+                return;
+        }
+        setMatrix(options.matrix);
+    } else if (options.downmix != Downmix::None) {
+        if (inChannels >= sizeof(stereoDownmix) / sizeof(stereoDownmix[0]))
+            return;
+        std::vector<std::vector<float> > matrix = inChannels == 2
+            ? std::vector<std::vector<float> >{ { 1, 0 }, { 0, 1 } }
+            : stereoDownmix[inChannels];
+        if (options.downmix == Downmix::Mono) {
+            if (inChannels == 1)
+                return;
+            std::vector<float> mono(inChannels);
+            for (unsigned i = 0; i < inChannels; ++i)
+                mono[i] = (matrix[0][i] + matrix[1][i]) * .5f;
+            matrix.assign(1, mono);
+        }
+        // keep full scale material from clipping after the fold down
+        float peak = 0;
+        for (const auto& row : matrix) {
+            float sum = 0;
+            for (float v : row)
+                sum += v;
+            peak = std::max(peak, sum);
+        }
+        if (peak > 1.f) {
+            for (auto& row : matrix) {
+                for (float& v : row)
+                    v /= peak;
+            }
+        }
+        setMatrix(matrix);
+    } else if (!options.channelMap.empty()) {
+        std::vector<std::vector<float> > matrix;
+        for (unsigned src : options.channelMap) {
+            if (src >= inChannels)
+                return;
+            matrix.push_back(std::vector<float>(inChannels, 0.f));
+            matrix.back()[src] = 1.f;
+        }
+        setMatrix(matrix);
+    }
+}
+
+void Mixer::setMatrix(const std::vector<std::vector<float> >& matrix)
+{
+    outChannels = matrix.size();
+    coefficients.resize(outChannels * inChannels);
+    map.resize(outChannels);
+
+    bool picks = true, identity = outChannels == inChannels;
+    for (unsigned o = 0; o < outChannels; ++o) {
+        unsigned ones = 0, nonzero = 0;
+        for (unsigned i = 0; i < inChannels; ++i) {
+            const float v = matrix[o][i];
+            coefficients[o * inChannels + i] = v;
+            if (v != 0.f) {
+                ++nonzero;
+                if (v == 1.f) {
+                    ++ones;
+                    map[o] = i;
+                }
+            }
+        }
+        if (nonzero != 1 || ones != 1) {
+            picks = false;
+        } else if (map[o] != o) {
+            identity = false;
+        }
+    }
+
+    if (picks) {
+        remaps = !identity;
+    } else {
+        mixes = true;
+    }
+}
+
+void Mixer::remap(const FLAC__int32* const in[], const FLAC__int32* out[]) const
+{
+    for (unsigned o = 0; o < outChannels; ++o)
+        out[o] = in[map[o]];
+}
+
+void Mixer::mix(const FLAC__int32* const in[], float scale, unsigned samples, std::vector<float> out[]) const
+{
+    for (unsigned o = 0; o < outChannels; ++o) {
+        std::vector<float>& dst = out[o];
+        dst.assign(samples, 0.f);
+        float* d = dst.data();
+        for (unsigned i = 0; i < inChannels; ++i) {
+            const float k = coefficients[o * inChannels + i] * scale;
+            if (k == 0.f)
+                continue;
+            const FLAC__int32* s = in[i];
+            for (unsigned n = 0; n < samples; ++n)
+                d[n] += s[n] * k;
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <FLAC/stream_decoder.h>
+#include <vector>
+
+// channel remapping and mixing matrix applied to the planar decoder output.
+// a matrix that only picks channels is done by reordering the plane
+// pointers, anything else mixes into float planes.
+class Mixer
+{
+public:
+    enum class Downmix { None, Mono, Stereo };
+
+    struct Options
+    {
+        // output channel i is input channel channelMap[i]
+        std::vector<unsigned> channelMap;
+        // one row per output channel, one column per input channel
+        std::vector<std::vector<float> > matrix;
+        Downmix downmix = Downmix::None;
+    };
+
+    Mixer();
+
+    // options that don't fit the source layout leave it untouched.
+    // callers keep the output at no more than FLAC__MAX_CHANNELS
+    void configure(const Options& options, unsigned inChannels);
+
+    unsigned channels() const { return outChannels; }
+    bool mixing() const { return mixes; }
+    bool remapping() const { return remaps; }
+
+    // reorders the plane pointers, only valid when remapping()
+    void remap(const FLAC__int32* const in[], const FLAC__int32* out[]) const;
+    // out[c] is resized to samples, scale converts input to float
+    void mix(const FLAC__int32* const in[], float scale, unsigned samples, std::vector<float> out[]) const;
+
+    static bool parseDownmix(const char* name, Downmix* downmix);
+
+private:
+    void setMatrix(const std::vector<std::vector<float> >& matrix);
+
+    unsigned inChannels, outChannels;
+    bool mixes, remaps;
+    std::vector<unsigned> map;
+    std::vector<float> coefficients; // outChannels * inChannels
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include "pack.h"
+#include "simd.h"
+#include <cstring>
+
+uint32_t outputBitsPerSample(uint32_t bitsPerSample, bool packed24)
+{
+    if (bitsPerSample == 24 && !packed24)
+        return 32;
+    return bitsPerSample;
+}
+
+static inline void store24(unsigned char* ptr, FLAC__int32 sample)
+{
+    *(ptr++) = sample;
+    *(ptr++) = sample >> 8;
+    *(ptr++) = sample >> 16;
+}
+
+// low three bytes of each 32 bit lane, the top four output bytes are zeroed
+#if defined(FLAC_SIMD_SSSE3_DISPATCH)
+FLAC_TARGET_SSSE3 static inline void store24x4(unsigned char* ptr, __m128i v)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    v = _mm_shuffle_epi8(v, shuffle);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(ptr), v);
+    const uint32_t high = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    memcpy(ptr + 8, &high, sizeof(high));
+}
+
+FLAC_TARGET_SSSE3 static unsigned pack24SSSE3(unsigned char* ptr, const FLAC__int32* const buffer[],
+                                              unsigned channels, unsigned samples)
+{
+    unsigned i = 0;
+    if (channels == 1) {
+        for (; i + 4 <= samples; i += 4) {
+            store24x4(ptr, _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer[0] + i)));
+            ptr += 12;
+        }
+    } else if (channels == 2) {
+        for (; i + 4 <= samples; i += 4) {
+            const __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer[0] + i));
+            const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer[1] + i));
+            store24x4(ptr, _mm_unpacklo_epi32(l, r));
+            store24x4(ptr + 12, _mm_unpackhi_epi32(l, r));
+            ptr += 24;
+        }
+    }
+    return i;
+}
+#elif defined(FLAC_SIMD_NEON)
+static inline void store24x4(unsigned char* ptr, int32x4_t v)
+{
+    static const uint8_t shuffle[16] = { 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 255, 255, 255, 255 };
+    const uint8x16_t bytes = vqtbl1q_u8(vreinterpretq_u8_s32(v), vld1q_u8(shuffle));
+    vst1_u8(ptr, vget_low_u8(bytes));
+    vst1q_lane_u32(reinterpret_cast<uint32_t*>(ptr + 8), vreinterpretq_u32_u8(bytes), 2);
+}
+
+static unsigned pack24NEON(unsigned char* ptr, const FLAC__int32* const buffer[],
+                           unsigned channels, unsigned samples)
+{
+    unsigned i = 0;
+    if (channels == 1) {
+        for (; i + 4 <= samples; i += 4) {
+            store24x4(ptr, vld1q_s32(buffer[0] + i));
+            ptr += 12;
+        }
+    } else if (channels == 2) {
+        for (; i + 4 <= samples; i += 4) {
+            const int32x4x2_t lr = vzipq_s32(vld1q_s32(buffer[0] + i), vld1q_s32(buffer[1] + i));
+            store24x4(ptr, lr.val[0]);
+            store24x4(ptr + 12, lr.val[1]);
+            ptr += 24;
+        }
+    }
+    return i;
+}
+#endif
+
+static void pack24(unsigned char* ptr, const FLAC__int32* const buffer[],
+                   unsigned channels, unsigned samples)
+{
+    unsigned i = 0;
+#if defined(FLAC_SIMD_SSSE3_DISPATCH)
+    if (haveSSSE3())
+        i = pack24SSSE3(ptr, buffer, channels, samples);
+#elif defined(FLAC_SIMD_NEON)
+    i = pack24NEON(ptr, buffer, channels, samples);
+#endif
+    ptr += i * channels * 3;
+    for (; i < samples; ++i) {
+        for (unsigned int j = 0; j < channels; ++j) {
+            store24(ptr, buffer[j][i]);
+            ptr += 3;
+        }
+    }
+}
+
+void packSamples(unsigned char* ptr, const FLAC__int32* const buffer[],
+                 unsigned channels, unsigned samples,
+                 uint32_t bitsPerSample, bool packed24)
+{
+    switch (bitsPerSample) {
+    case 8:
+        for (unsigned i = 0; i < samples; ++i) {
+            for (unsigned int j = 0; j < channels; ++j) {
+                *(ptr++) = buffer[j][i];
+            }
+        }
+        break;
+    case 16:
+        for (unsigned i = 0; i < samples; ++i) {
+            for (unsigned int j = 0; j < channels; ++j) {
+                *(ptr++) = buffer[j][i];
+                *(ptr++) = buffer[j][i] >> 8;
+            }
+        }
+        break;
+    case 24:
+        if (packed24) {
+            pack24(ptr, buffer, channels, samples);
+            break;
+        }
+        for (unsigned i = 0; i < samples; ++i) {
+            for (unsigned int j = 0; j < channels; ++j) {
+                *(ptr++) = 0;
+                store24(ptr, buffer[j][i]);
+                ptr += 3;
+            }
+        }
+        break;
+    case 32:
+        for (unsigned i = 0; i < samples; ++i) {
+            for (unsigned int j = 0; j < channels; ++j) {
+                *(ptr++) = buffer[j][i];
+                *(ptr++) = buffer[j][i] >> 8;
+                *(ptr++) = buffer[j][i] >> 16;
+                *(ptr++) = buffer[j][i] >> 24;
+            }
+        }
+        break;
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <FLAC/stream_decoder.h>
+#include <cstdint>
+
+// number of bits each sample occupies in the interleaved output.
+// 24 bit samples are padded to 32 bits unless packed is set.
+uint32_t outputBitsPerSample(uint32_t bitsPerSample, bool packed24);
+
+// interleave planar decoder output into little endian pcm.
+// out needs room for samples * channels * outputBitsPerSample() / 8 bytes
+void packSamples(unsigned char* out, const FLAC__int32* const buffer[],
+                 unsigned channels, unsigned samples,
+                 uint32_t bitsPerSample, bool packed24);
+
+#endif
@@ -0,0 +1,93 @@
+#include "peaks.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+PeaksAnalyzer::PeaksAnalyzer(double perSecond)
+    : bucketsPerSecond(perSecond), sampleRate(0), scale(1.f),
+      bucket(0), position(0), bucketEnd(0), bucketSamples(0)
+{
+}
+
+void PeaksAnalyzer::format(uint32_t rate, uint32_t count, uint32_t bitsPerSample)
+{
+    // a format change mid stream starts the buckets over
+    sampleRate = rate;
+    scale = 1.f / static_cast<float>(1u << (bitsPerSample - 1));
+    channels.assign(count, Channel());
+    for (auto& c : channels) {
+        c.bucketMin = std::numeric_limits<FLAC__int32>::max();
+        c.bucketMax = std::numeric_limits<FLAC__int32>::min();
+        c.sumSquares = 0.;
+    }
+    bucket = position = bucketSamples = 0;
+    bucketEnd = std::max<uint64_t>(1, static_cast<uint64_t>(sampleRate / bucketsPerSecond));
+}
+
+void PeaksAnalyzer::process(const FLAC__int32* const buffer[], unsigned samples)
+{
+    unsigned offset = 0;
+    while (offset < samples) {
+        const unsigned run = static_cast<unsigned>(std::min<uint64_t>(samples - offset, bucketEnd - position));
+        for (size_t c = 0; c < channels.size(); ++c) {
+            Channel& ch = channels[c];
+            const FLAC__int32* src = buffer[c] + offset;
+            FLAC__int32 lo = ch.bucketMin, hi = ch.bucketMax;
+            double sum = 0.;
+            for (unsigned i = 0; i < run; ++i) {
+                lo = std::min(lo, src[i]);
+                hi = std::max(hi, src[i]);
+                sum += static_cast<double>(src[i]) * src[i];
+            }
+            ch.bucketMin = lo;
+            ch.bucketMax = hi;
+            ch.sumSquares += sum;
+        }
+        offset += run;
+        position += run;
+        bucketSamples += run;
+        if (position == bucketEnd)
+            closeBucket();
+    }
+}
+
+void PeaksAnalyzer::closeBucket()
+{
+    if (!bucketSamples)
+        return;
+    for (auto& ch : channels) {
+        ch.min.push_back(ch.bucketMin * scale);
+        ch.max.push_back(ch.bucketMax * scale);
+        ch.rms.push_back(static_cast<float>(std::sqrt(ch.sumSquares / bucketSamples)) * scale);
+        ch.bucketMin = std::numeric_limits<FLAC__int32>::max();
+        ch.bucketMax = std::numeric_limits<FLAC__int32>::min();
+        ch.sumSquares = 0.;
+    }
+    bucketSamples = 0;
+    // bucket boundaries are computed from the start so they don't drift
+    ++bucket;
+    bucketEnd = std::max(position + 1, static_cast<uint64_t>((bucket + 1) * sampleRate / bucketsPerSecond));
+}
+
+void PeaksAnalyzer::finish()
+{
+    closeBucket();
+}
+
+v8::Local<v8::Value> PeaksAnalyzer::result() const
+{
+    Nan::EscapableHandleScope scope;
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, Nan::New("sampleRate").ToLocalChecked(), Nan::New<v8::Number>(sampleRate));
+    Nan::Set(obj, Nan::New("bucketsPerSecond").ToLocalChecked(), Nan::New<v8::Number>(bucketsPerSecond));
+    v8::Local<v8::Array> list = Nan::New<v8::Array>(channels.size());
+    for (size_t c = 0; c < channels.size(); ++c) {
+        v8::Local<v8::Object> ch = Nan::New<v8::Object>();
+        Nan::Set(ch, Nan::New("min").ToLocalChecked(), toFloat32Array(channels[c].min));
+        Nan::Set(ch, Nan::New("max").ToLocalChecked(), toFloat32Array(channels[c].max));
+        Nan::Set(ch, Nan::New("rms").ToLocalChecked(), toFloat32Array(channels[c].rms));
+        Nan::Set(list, c, ch);
+    }
+    Nan::Set(obj, Nan::New("channels").ToLocalChecked(), list);
+    return scope.Escape(obj);
+}
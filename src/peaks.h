@@ -0,0 +1,38 @@
+#ifndef PEAKS_H
+#define PEAKS_H
+
+#include "analyzer.h"
+
+// per channel min, max and rms over fixed time buckets, for waveform views
+class PeaksAnalyzer : public Analyzer
+{
+public:
+    explicit PeaksAnalyzer(double bucketsPerSecond);
+
+    const char* name() const override { return "peaks"; }
+
+    void format(uint32_t sampleRate, uint32_t channels, uint32_t bitsPerSample) override;
+    void process(const FLAC__int32* const buffer[], unsigned samples) override;
+    void finish() override;
+
+    v8::Local<v8::Value> result() const override;
+
+private:
+    void closeBucket();
+
+    struct Channel
+    {
+        std::vector<float> min, max, rms;
+        FLAC__int32 bucketMin, bucketMax;
+        double sumSquares;
+    };
+
+    double bucketsPerSecond;
+    uint32_t sampleRate;
+    float scale;
+    std::vector<Channel> channels;
+    uint64_t bucket, position, bucketEnd;
+    uint64_t bucketSamples;
+};
+
+#endif
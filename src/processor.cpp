@@ -0,0 +1,157 @@
+#include "processor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+Processor::Processor()
+    : inRate(0), inChannels(0), inBits(0), outRate(0), outChannels(0), gain(1.f)
+{
+}
+
+std::vector<std::pair<std::string, std::string> > Processor::parseTags(const FLAC__StreamMetadata_VorbisComment& vorbis)
+{
+    std::vector<std::pair<std::string, std::string> > tags;
+    auto split = [&tags](const FLAC__StreamMetadata_VorbisComment_Entry& entry) {
+        const char* estr = reinterpret_cast<const char*>(entry.entry);
+        const char* eq = static_cast<const char*>(std::memchr(estr, '=', entry.length));
+        if (eq == nullptr)
+            return;
+        tags.push_back(std::make_pair(std::string(estr, eq), std::string(eq + 1, estr + entry.length)));
+    };
+    split(vorbis.vendor_string);
+    for (uint32_t i = 0; i < vorbis.num_comments; ++i) {
+        split(vorbis.comments[i]);
+    }
+    return tags;
+}
+
+void Processor::setTags(const std::vector<std::pair<std::string, std::string> >& tags)
+{
+    replayGain.reset();
+    for (const auto& tag : tags)
+        replayGain.setTag(tag.first, tag.second);
+    gain = replayGain.factor(options.gain);
+}
+
+bool Processor::matches(uint32_t sampleRate, uint32_t channels, uint32_t bitsPerSample) const
+{
+    return sampleRate == inRate && channels == inChannels && bitsPerSample == inBits;
+}
+
+void Processor::configure(uint32_t sampleRate, uint32_t channels, uint32_t bitsPerSample, std::string& out)
+{
+    flush(out);
+
+    inRate = sampleRate;
+    inChannels = channels;
+    inBits = bitsPerSample;
+
+    outRate = options.sampleRate ? options.sampleRate : inRate;
+    mixer.configure(options.mixing, inChannels);
+    outChannels = mixer.channels();
+
+    resampler.init(inRate, outRate, outChannels, options.quality);
+    gain = replayGain.factor(options.gain);
+
+    input.assign(outChannels, std::vector<float>());
+    output.assign(outChannels, std::vector<float>());
+    quantized.assign(outChannels, std::vector<FLAC__int32>());
+}
+
+void Processor::process(const FLAC__int32* const buffer[], unsigned samples, std::string& out)
+{
+    const FLAC__int32* remapped[FLAC__MAX_CHANNELS];
+    if (mixer.remapping()) {
+        mixer.remap(buffer, remapped);
+        buffer = remapped;
+    }
+
+    if (!mixer.mixing() && !resampler.active()) {
+        const FLAC__int32* gained[FLAC__MAX_CHANNELS];
+        if (gain != 1.f) {
+            quantize(buffer, samples, gained);
+            buffer = gained;
+        }
+        const size_t where = out.size();
+        out.resize(where + samples * outChannels * (bitsPerSample() / 8));
+        packSamples(reinterpret_cast<unsigned char*>(&out[where]), buffer,
+                    outChannels, samples, inBits, options.packed24);
+        return;
+    }
+
+    const float scale = 1.f / static_cast<float>(1u << (inBits - 1));
+    if (mixer.mixing()) {
+        mixer.mix(buffer, scale, samples, input.data());
+    } else {
+        for (uint32_t c = 0; c < outChannels; ++c) {
+            auto& in = input[c];
+            in.resize(samples);
+            for (unsigned i = 0; i < samples; ++i)
+                in[i] = buffer[c][i] * scale;
+        }
+    }
+
+    if (resampler.active()) {
+        const float* planes[FLAC__MAX_CHANNELS];
+        for (uint32_t c = 0; c < outChannels; ++c)
+            planes[c] = input[c].data();
+        resampler.process(planes, samples, output.data());
+    } else {
+        output.swap(input);
+    }
+    emit(out);
+}
+
+void Processor::flush(std::string& out)
+{
+    if (!resampler.active())
+        return;
+    resampler.flush(output.data());
+    emit(out);
+}
+
+// integer path, gain applied straight to the decoder samples
+void Processor::quantize(const FLAC__int32* const buffer[], unsigned samples, const FLAC__int32* planes[])
+{
+    const double scale = static_cast<double>(1u << (inBits - 1));
+    const double lo = -scale, hi = scale - 1.;
+    for (uint32_t c = 0; c < outChannels; ++c) {
+        auto& q = quantized[c];
+        q.resize(samples);
+        const FLAC__int32* src = buffer[c];
+        for (unsigned i = 0; i < samples; ++i) {
+            const double v = std::min(std::max(src[i] * static_cast<double>(gain), lo), hi);
+            q[i] = static_cast<FLAC__int32>(std::lrint(v));
+        }
+        planes[c] = q.data();
+    }
+}
+
+void Processor::emit(std::string& out)
+{
+    const size_t samples = output.empty() ? 0 : output[0].size();
+    if (!samples)
+        return;
+
+    // the gain is folded into the float to integer conversion
+    const double scale = static_cast<double>(1u << (inBits - 1));
+    const double amp = scale * gain;
+    const double lo = -scale, hi = scale - 1.;
+    const FLAC__int32* planes[FLAC__MAX_CHANNELS];
+    for (uint32_t c = 0; c < outChannels; ++c) {
+        auto& q = quantized[c];
+        q.resize(samples);
+        const float* src = output[c].data();
+        for (size_t i = 0; i < samples; ++i) {
+            const double v = std::min(std::max(src[i] * amp, lo), hi);
+            q[i] = static_cast<FLAC__int32>(std::lrint(v));
+        }
+        output[c].clear();
+        planes[c] = q.data();
+    }
+
+    const size_t where = out.size();
+    out.resize(where + samples * outChannels * (bitsPerSample() / 8));
+    packSamples(reinterpret_cast<unsigned char*>(&out[where]), planes,
+                outChannels, samples, inBits, options.packed24);
+}
@@ -0,0 +1,68 @@
+#ifndef PROCESSOR_H
+#define PROCESSOR_H
+
+#include <FLAC/stream_decoder.h>
+#include "mixer.h"
+#include "pack.h"
+#include "replaygain.h"
+#include "resampler.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// turns planar decoder output into the interleaved pcm handed to js.
+// everything runs on the decoder thread, straight off the frame buffers.
+class Processor
+{
+public:
+    struct Options
+    {
+        bool packed24 = false;
+        uint32_t sampleRate = 0;    // 0 keeps the source rate
+        Resampler::Quality quality = Resampler::Quality::Medium;
+        Mixer::Options mixing;
+        ReplayGain::Options gain;
+    };
+
+    Processor();
+
+    void setOptions(const Options& opts) { options = opts; }
+
+    bool matches(uint32_t sampleRate, uint32_t channels, uint32_t bitsPerSample) const;
+    // (re)configures the chain for a new source format, what the previous
+    // format still holds is flushed to out first
+    void configure(uint32_t sampleRate, uint32_t channels, uint32_t bitsPerSample, std::string& out);
+
+    uint32_t sampleRate() const { return outRate; }
+    uint32_t channels() const { return outChannels; }
+    uint32_t bitsPerSample() const { return ::outputBitsPerSample(inBits, options.packed24); }
+
+    // splits a vorbis comment block into name/value pairs, entries without
+    // a '=' are skipped
+    static std::vector<std::pair<std::string, std::string> > parseTags(const FLAC__StreamMetadata_VorbisComment& vorbis);
+    // vorbis comments of the stream, picks up the replaygain tags
+    void setTags(const std::vector<std::pair<std::string, std::string> >& tags);
+
+    // appends interleaved little endian pcm to out
+    void process(const FLAC__int32* const buffer[], unsigned samples, std::string& out);
+    // emits whatever the stages still hold at the end of a stream
+    void flush(std::string& out);
+
+private:
+    void emit(std::string& out);
+    void quantize(const FLAC__int32* const buffer[], unsigned samples, const FLAC__int32* planes[]);
+
+    Options options;
+    uint32_t inRate, inChannels, inBits;
+    uint32_t outRate, outChannels;
+
+    Mixer mixer;
+    Resampler resampler;
+    ReplayGain replayGain;
+    float gain;
+
+    std::vector<std::vector<float> > input, output;
+    std::vector<std::vector<FLAC__int32> > quantized;
+};
+
+#endif
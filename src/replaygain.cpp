@@ -0,0 +1,83 @@
+#include "replaygain.h"
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+static bool equalsNoCase(const std::string& a, const char* b)
+{
+    const size_t len = strlen(b);
+    if (a.size() != len)
+        return false;
+    for (size_t i = 0; i < len; ++i) {
+        if (toupper(static_cast<unsigned char>(a[i])) != toupper(static_cast<unsigned char>(b[i])))
+            return false;
+    }
+    return true;
+}
+
+ReplayGain::ReplayGain()
+{
+    reset();
+}
+
+void ReplayGain::reset()
+{
+    trackGain = albumGain = 0.;
+    trackPeak = albumPeak = 0.;
+    hasTrack = hasAlbum = false;
+}
+
+bool ReplayGain::parseMode(const char* name, Mode* mode)
+{
+    if (!strcmp(name, "off")) {
+        *mode = Mode::Off;
+    } else if (!strcmp(name, "track")) {
+        *mode = Mode::Track;
+    } else if (!strcmp(name, "album")) {
+        *mode = Mode::Album;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void ReplayGain::setTag(const std::string& key, const std::string& value)
+{
+    // vorbis comment field names are case insensitive, values look like "-6.54 dB"
+    const double v = strtod(value.c_str(), nullptr);
+    if (equalsNoCase(key, "REPLAYGAIN_TRACK_GAIN")) {
+        trackGain = v;
+        hasTrack = true;
+    } else if (equalsNoCase(key, "REPLAYGAIN_TRACK_PEAK")) {
+        trackPeak = v;
+    } else if (equalsNoCase(key, "REPLAYGAIN_ALBUM_GAIN")) {
+        albumGain = v;
+        hasAlbum = true;
+    } else if (equalsNoCase(key, "REPLAYGAIN_ALBUM_PEAK")) {
+        albumPeak = v;
+    }
+}
+
+float ReplayGain::factor(const Options& options) const
+{
+    double db, peak;
+    if (options.fixed) {
+        db = options.db;
+        peak = trackPeak;
+    } else if (options.mode == Mode::Album && hasAlbum) {
+        db = albumGain + options.preamp;
+        peak = albumPeak;
+    } else if (options.mode != Mode::Off && hasTrack) {
+        // album mode falls back to the track gain when there is no album gain
+        db = trackGain + options.preamp;
+        peak = trackPeak;
+    } else {
+        return 1.f;
+    }
+
+    double linear = std::pow(10., db / 20.);
+    if (options.preventClipping && peak > 0. && linear * peak > 1.)
+        linear = 1. / peak;
+    return static_cast<float>(linear);
+}
@@ -0,0 +1,36 @@
+#ifndef REPLAYGAIN_H
+#define REPLAYGAIN_H
+
+#include <string>
+
+// gain picked from the REPLAYGAIN_* vorbis comments or given explicitly
+class ReplayGain
+{
+public:
+    enum class Mode { Off, Track, Album };
+
+    struct Options
+    {
+        Mode mode = Mode::Off;
+        bool fixed = false;         // use db instead of the tags
+        double db = 0.;
+        double preamp = 0.;         // added to the tag gain
+        bool preventClipping = true;
+    };
+
+    ReplayGain();
+
+    void reset();
+    void setTag(const std::string& key, const std::string& value);
+
+    // linear factor, limited so the known peak stays below full scale
+    float factor(const Options& options) const;
+
+    static bool parseMode(const char* name, Mode* mode);
+
+private:
+    double trackGain, trackPeak, albumGain, albumPeak;
+    bool hasTrack, hasAlbum;
+};
+
+#endif
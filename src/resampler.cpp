@@ -0,0 +1,207 @@
+#include "resampler.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+static const double pi = 3.14159265358979323846;
+
+static double besselI0(double x)
+{
+    double sum = 1., term = 1.;
+    for (int k = 1; k < 64; ++k) {
+        term *= (x / (2. * k)) * (x / (2. * k));
+        sum += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+    return sum;
+}
+
+static inline float dot(const float* a, const float* b, unsigned n)
+{
+#if defined(FLAC_SIMD_SSE2)
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    for (; i < n; i += 4)
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    return _mm_cvtss_f32(acc0);
+#elif defined(FLAC_SIMD_NEON)
+    float32x4_t acc = vdupq_n_f32(0.f);
+    for (unsigned i = 0; i < n; i += 4)
+        acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    return vaddvq_f32(acc);
+#else
+    float acc = 0.f;
+    for (unsigned i = 0; i < n; ++i)
+        acc += a[i] * b[i];
+    return acc;
+#endif
+}
+
+Resampler::Resampler()
+    : inRate(0), outRate(0), up(1), down(1), channels(0), taps(0), phases(0),
+      interpolate(false), position(0), phase(0), consumed(0), produced(0)
+{
+}
+
+bool Resampler::parseQuality(const char* name, Quality* quality)
+{
+    if (!strcmp(name, "fast")) {
+        *quality = Quality::Fast;
+    } else if (!strcmp(name, "medium")) {
+        *quality = Quality::Medium;
+    } else if (!strcmp(name, "best")) {
+        *quality = Quality::Best;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void Resampler::init(uint32_t in, uint32_t out, unsigned ch, Quality quality)
+{
+    inRate = in;
+    outRate = out;
+    channels = ch;
+    history.assign(channels, std::vector<float>());
+    filter.clear();
+    if (!active())
+        return;
+
+    const uint32_t g = std::gcd(inRate, outRate);
+    up = outRate / g;
+    down = inRate / g;
+
+    unsigned baseTaps;
+    double beta, rolloff;
+    switch (quality) {
+    case Quality::Fast:
+        baseTaps = 16;
+        beta = 6.;
+        rolloff = .85;
+        break;
+    case Quality::Medium:
+    default:
+        baseTaps = 32;
+        beta = 8.;
+        rolloff = .92;
+        break;
+    case Quality::Best:
+        baseTaps = 64;
+        beta = 10.;
+        rolloff = .95;
+        break;
+    }
+
+    // when decimating the cutoff drops below the input nyquist, so the
+    // filter has to span proportionally more input samples
+    const double cutoff = std::min(1., static_cast<double>(up) / down);
+    taps = static_cast<unsigned>(std::ceil(baseTaps / cutoff));
+    taps = (taps + 3) & ~3u;
+    const double fc = cutoff * rolloff;
+    const double half = taps / 2.;
+
+    interpolate = up > maxDirectPhases;
+    phases = interpolate ? interpolatedPhases : up;
+    const unsigned rows = interpolate ? phases + 1 : phases;
+    filter.resize(static_cast<size_t>(rows) * taps);
+
+    const double norm = besselI0(beta);
+    for (unsigned p = 0; p < rows; ++p) {
+        const double frac = static_cast<double>(p) / phases;
+        float* row = &filter[static_cast<size_t>(p) * taps];
+        double sum = 0.;
+        for (unsigned k = 0; k < taps; ++k) {
+            // distance from tap k to the output position, in input samples
+            const double t = frac + half - 1. - k;
+            const double x = fc * t;
+            const double sinc = x == 0. ? 1. : std::sin(pi * x) / (pi * x);
+            const double r = t / half;
+            const double window = r <= -1. || r >= 1. ? 0. : besselI0(beta * std::sqrt(1. - r * r)) / norm;
+            row[k] = static_cast<float>(fc * sinc * window);
+            sum += row[k];
+        }
+        // unity gain at dc for every phase
+        for (unsigned k = 0; k < taps; ++k)
+            row[k] = static_cast<float>(row[k] / sum);
+    }
+
+    reset();
+}
+
+void Resampler::reset()
+{
+    for (auto& h : history)
+        h.assign(taps ? taps / 2 - 1 : 0, 0.f);
+    position = 0;
+    phase = 0;
+    consumed = 0;
+    produced = 0;
+}
+
+void Resampler::run(std::vector<float> out[], uint64_t limit)
+{
+    const size_t available = history.empty() ? 0 : history[0].size();
+    while (position + taps <= available && produced < limit) {
+        const float* row;
+        float mix = 0.f;
+        if (interpolate) {
+            const uint64_t scaled = static_cast<uint64_t>(phase) * phases;
+            row = &filter[(scaled / up) * taps];
+            mix = static_cast<float>(scaled % up) / up;
+        } else {
+            row = &filter[static_cast<size_t>(phase) * taps];
+        }
+        for (unsigned c = 0; c < channels; ++c) {
+            const float* src = &history[c][position];
+            float value = dot(src, row, taps);
+            if (mix != 0.f)
+                value += (dot(src, row + taps, taps) - value) * mix;
+            out[c].push_back(value);
+        }
+        ++produced;
+        phase += down;
+        position += phase / up;
+        phase %= up;
+    }
+
+    // drop input no future output can reach
+    if (position) {
+        for (auto& h : history)
+            h.erase(h.begin(), h.begin() + std::min<uint64_t>(position, h.size()));
+        position = 0;
+    }
+}
+
+void Resampler::process(const float* const in[], unsigned samples, std::vector<float> out[])
+{
+    if (!active()) {
+        for (unsigned c = 0; c < channels; ++c)
+            out[c].insert(out[c].end(), in[c], in[c] + samples);
+        return;
+    }
+    for (unsigned c = 0; c < channels; ++c)
+        history[c].insert(history[c].end(), in[c], in[c] + samples);
+    consumed += samples;
+    run(out, UINT64_MAX);
+}
+
+void Resampler::flush(std::vector<float> out[])
+{
+    if (!active())
+        return;
+    for (auto& h : history)
+        h.insert(h.end(), taps, 0.f);
+    // exactly ceil(consumed * up / down) samples for the whole stream
+    run(out, (consumed * up + down - 1) / down);
+    reset();
+}
@@ -0,0 +1,48 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <cstdint>
+#include <vector>
+
+// windowed sinc polyphase resampler working on planar float samples.
+// ratios that reduce to at most maxDirectPhases output phases get an exact
+// filter bank, anything else interpolates between a fixed set of phases.
+class Resampler
+{
+public:
+    enum class Quality { Fast, Medium, Best };
+
+    Resampler();
+
+    void init(uint32_t inRate, uint32_t outRate, unsigned channels, Quality quality);
+    void reset();
+
+    bool active() const { return inRate != outRate; }
+
+    // appends the resampled output for each channel to out[channel]
+    void process(const float* const in[], unsigned samples, std::vector<float> out[]);
+    // pads with silence so the tail of the filter is emitted
+    void flush(std::vector<float> out[]);
+
+    static bool parseQuality(const char* name, Quality* quality);
+
+private:
+    void run(std::vector<float> out[], uint64_t limit);
+
+    static constexpr unsigned maxDirectPhases = 1024, interpolatedPhases = 256;
+
+    uint32_t inRate, outRate;
+    uint32_t up, down;          // reduced ratio, out = in * up / down
+    unsigned channels;
+    unsigned taps;              // per phase, multiple of 4
+    unsigned phases;
+    bool interpolate;
+    std::vector<float> filter;  // phases (+1 when interpolating) * taps
+
+    std::vector<std::vector<float> > history;
+    uint64_t position;          // index into history of the next output's first tap
+    uint32_t phase;             // 0 .. up - 1
+    uint64_t consumed, produced;
+};
+
+#endif
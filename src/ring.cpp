@@ -0,0 +1,74 @@
+#include "ring.h"
+#include <algorithm>
+#include <cstring>
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "atomic uint32 has to match the js Uint32Array");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "js and the decoder thread share the ring without locks");
+
+Ring::Ring()
+    : header(nullptr), data(nullptr), mask(0)
+{
+}
+
+bool Ring::fits(size_t size)
+{
+    if (size <= HeaderSize)
+        return false;
+    const size_t capacity = size - HeaderSize;
+    return capacity <= (size_t(1) << 31) && (capacity & (capacity - 1)) == 0;
+}
+
+void Ring::attach(void* buffer, size_t size)
+{
+    header = static_cast<std::atomic<uint32_t>*>(buffer);
+    data = static_cast<unsigned char*>(buffer) + HeaderSize;
+    mask = static_cast<uint32_t>(size - HeaderSize - 1);
+}
+
+void Ring::detach()
+{
+    header = nullptr;
+    data = nullptr;
+    mask = 0;
+}
+
+void Ring::begin()
+{
+    slot(Flags).store(0, std::memory_order_release);
+}
+
+uint32_t Ring::pending() const
+{
+    return slot(Write).load(std::memory_order_relaxed) - slot(Read).load(std::memory_order_acquire);
+}
+
+void Ring::setFormat(uint32_t sampleRate, uint32_t channels, uint32_t bitsPerSample)
+{
+    slot(SampleRate).store(sampleRate, std::memory_order_relaxed);
+    slot(Channels).store(channels, std::memory_order_relaxed);
+    slot(BitDepth).store(bitsPerSample, std::memory_order_release);
+}
+
+size_t Ring::write(const char* src, size_t size)
+{
+    const uint32_t wpos = slot(Write).load(std::memory_order_relaxed);
+    const uint32_t rpos = slot(Read).load(std::memory_order_acquire);
+    const size_t space = mask + 1 - static_cast<uint32_t>(wpos - rpos);
+    if (size > space)
+        size = space;
+    if (!size)
+        return 0;
+
+    const size_t offset = wpos & mask;
+    const size_t first = std::min<size_t>(size, mask + 1 - offset);
+    memcpy(data + offset, src, first);
+    memcpy(data, src + first, size - first);
+    // publishes the bytes to the reader
+    slot(Write).store(wpos + static_cast<uint32_t>(size), std::memory_order_release);
+    return size;
+}
+
+void Ring::end()
+{
+    slot(Flags).fetch_or(Ended, std::memory_order_release);
+}
@@ -0,0 +1,53 @@
+#ifndef RING_H
+#define RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// the writing end of a single producer, single consumer pcm ring living in
+// a SharedArrayBuffer, read from js with RingReader (index.js). the buffer
+// starts with a header of uint32 slots followed by the data:
+//
+//   0 write position   1 read position   2 flags
+//   3 sample rate      4 channels        5 bit depth
+//
+// positions count bytes and wrap at 2^32, so the data size has to be a
+// power of two. only the writer moves the write position and only the
+// reader moves the read position
+class Ring
+{
+public:
+    enum { HeaderSize = 64 };
+    enum Slot { Write, Read, Flags, SampleRate, Channels, BitDepth };
+    enum Flag { Ended = 1 };
+
+    Ring();
+
+    // false unless size fits the layout above
+    static bool fits(size_t size);
+
+    void attach(void* buffer, size_t size);
+    void detach();
+    bool attached() const { return data != nullptr; }
+
+    // clears the flags for a new stream, the positions carry on
+    void begin();
+    // bytes written that the reader has not consumed yet
+    uint32_t pending() const;
+    // only call with nothing pending, the reader takes the format slots to
+    // describe every byte it still has to read
+    void setFormat(uint32_t sampleRate, uint32_t channels, uint32_t bitsPerSample);
+    // copies as much as fits, returns the number of bytes written
+    size_t write(const char* src, size_t size);
+    void end();
+
+private:
+    std::atomic<uint32_t>& slot(Slot s) const { return header[s]; }
+
+    std::atomic<uint32_t>* header;
+    unsigned char* data;
+    uint32_t mask;
+};
+
+#endif
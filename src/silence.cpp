@@ -0,0 +1,120 @@
+#include "silence.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+
+SilenceAnalyzer::SilenceAnalyzer(double db, double duration)
+    : thresholdDb(db), minDuration(duration), sampleRate(0), channels(0), threshold(0),
+      minSamples(0), position(0), heard(false), firstLoud(0), lastLoud(0)
+{
+}
+
+void SilenceAnalyzer::format(uint32_t rate, uint32_t count, uint32_t bitsPerSample)
+{
+    // positions keep counting across format changes
+    sampleRate = rate;
+    channels = count;
+    const double fullScale = static_cast<double>(1u << (bitsPerSample - 1));
+    threshold = static_cast<FLAC__int32>(std::min(fullScale - 1., std::pow(10., thresholdDb / 20.) * fullScale));
+    minSamples = std::max<uint64_t>(1, static_cast<uint64_t>(minDuration * rate));
+}
+
+inline void SilenceAnalyzer::loud(uint64_t sample)
+{
+    if (!heard) {
+        heard = true;
+        firstLoud = sample;
+    } else if (sample - lastLoud - 1 >= minSamples) {
+        gaps.push_back(std::make_pair(lastLoud + 1, sample));
+    }
+    lastLoud = sample;
+}
+
+// bit i of the result is set when sample i of the four at offset is loud
+static inline unsigned loudMask(const FLAC__int32* const buffer[], unsigned channels, unsigned offset, FLAC__int32 threshold)
+{
+#if defined(FLAC_SIMD_SSE2)
+    const __m128i hi = _mm_set1_epi32(threshold), lo = _mm_set1_epi32(-threshold);
+    __m128i any = _mm_setzero_si128();
+    for (unsigned c = 0; c < channels; ++c) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer[c] + offset));
+        any = _mm_or_si128(any, _mm_or_si128(_mm_cmpgt_epi32(v, hi), _mm_cmplt_epi32(v, lo)));
+    }
+    return _mm_movemask_ps(_mm_castsi128_ps(any));
+#elif defined(FLAC_SIMD_NEON)
+    const int32x4_t hi = vdupq_n_s32(threshold), lo = vdupq_n_s32(-threshold);
+    uint32x4_t any = vdupq_n_u32(0);
+    for (unsigned c = 0; c < channels; ++c) {
+        const int32x4_t v = vld1q_s32(buffer[c] + offset);
+        any = vorrq_u32(any, vorrq_u32(vcgtq_s32(v, hi), vcltq_s32(v, lo)));
+    }
+    static const uint32_t bits[4] = { 1, 2, 4, 8 };
+    return vaddvq_u32(vandq_u32(any, vld1q_u32(bits)));
+#else
+    unsigned mask = 0;
+    for (unsigned i = 0; i < 4; ++i) {
+        for (unsigned c = 0; c < channels; ++c) {
+            const FLAC__int32 v = buffer[c][offset + i];
+            if (v > threshold || v < -threshold) {
+                mask |= 1u << i;
+                break;
+            }
+        }
+    }
+    return mask;
+#endif
+}
+
+void SilenceAnalyzer::process(const FLAC__int32* const buffer[], unsigned samples)
+{
+    unsigned i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        const unsigned mask = loudMask(buffer, channels, i, threshold);
+        if (!mask)
+            continue;
+        if (minSamples < 4) {
+            // gaps can hide between the loud samples of one group
+            for (unsigned b = 0; b < 4; ++b) {
+                if (mask & (1u << b))
+                    loud(position + i + b);
+            }
+        } else {
+            const unsigned first = mask & 1 ? 0 : mask & 2 ? 1 : mask & 4 ? 2 : 3;
+            const unsigned last = mask & 8 ? 3 : mask & 4 ? 2 : mask & 2 ? 1 : 0;
+            loud(position + i + first);
+            if (last != first)
+                lastLoud = position + i + last;
+        }
+    }
+    for (; i < samples; ++i) {
+        for (unsigned c = 0; c < channels; ++c) {
+            const FLAC__int32 v = buffer[c][i];
+            if (v > threshold || v < -threshold) {
+                loud(position + i);
+                break;
+            }
+        }
+    }
+    position += samples;
+}
+
+v8::Local<v8::Value> SilenceAnalyzer::result() const
+{
+    Nan::EscapableHandleScope scope;
+    const uint64_t leading = heard ? firstLoud : position;
+    const uint64_t trailing = heard ? position - lastLoud - 1 : position;
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, Nan::New("sampleRate").ToLocalChecked(), Nan::New<v8::Number>(sampleRate));
+    Nan::Set(obj, Nan::New("totalSamples").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(position)));
+    Nan::Set(obj, Nan::New("leading").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(leading)));
+    Nan::Set(obj, Nan::New("trailing").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(trailing)));
+    v8::Local<v8::Array> list = Nan::New<v8::Array>(gaps.size());
+    for (size_t i = 0; i < gaps.size(); ++i) {
+        v8::Local<v8::Object> gap = Nan::New<v8::Object>();
+        Nan::Set(gap, Nan::New("start").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(gaps[i].first)));
+        Nan::Set(gap, Nan::New("end").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(gaps[i].second)));
+        Nan::Set(list, i, gap);
+    }
+    Nan::Set(obj, Nan::New("gaps").ToLocalChecked(), list);
+    return scope.Escape(obj);
+}
@@ -0,0 +1,34 @@
+#ifndef SILENCE_H
+#define SILENCE_H
+
+#include "analyzer.h"
+
+// leading and trailing silence plus internal gaps, in samples. a sample is
+// silent when every channel stays within the threshold.
+class SilenceAnalyzer : public Analyzer
+{
+public:
+    SilenceAnalyzer(double thresholdDb, double minDuration);
+
+    const char* name() const override { return "silence"; }
+
+    void format(uint32_t sampleRate, uint32_t channels, uint32_t bitsPerSample) override;
+    void process(const FLAC__int32* const buffer[], unsigned samples) override;
+
+    v8::Local<v8::Value> result() const override;
+
+private:
+    void loud(uint64_t sample);
+
+    double thresholdDb, minDuration;
+    uint32_t sampleRate, channels;
+    FLAC__int32 threshold;
+    uint64_t minSamples;
+
+    uint64_t position;
+    bool heard;
+    uint64_t firstLoud, lastLoud;
+    std::vector<std::pair<uint64_t, uint64_t> > gaps;
+};
+
+#endif
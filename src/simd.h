@@ -0,0 +1,27 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// SSE2 is part of the x86_64 baseline, NEON of the aarch64 one, so these
+// need no runtime checks. Anything newer is dispatched at runtime.
+#if defined(__x86_64__) || defined(_M_X64)
+#  define FLAC_SIMD_SSE2 1
+#  include <emmintrin.h>
+#  if defined(__GNUC__)
+#    define FLAC_SIMD_SSSE3_DISPATCH 1
+#    include <tmmintrin.h>
+#    define FLAC_TARGET_SSSE3 __attribute__((target("ssse3")))
+#  endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#  define FLAC_SIMD_NEON 1
+#  include <arm_neon.h>
+#endif
+
+#if defined(FLAC_SIMD_SSSE3_DISPATCH)
+inline bool haveSSSE3()
+{
+    static const bool has = __builtin_cpu_supports("ssse3");
+    return has;
+}
+#endif
+
+#endif
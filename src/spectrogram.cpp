@@ -0,0 +1,94 @@
+#include "spectrogram.h"
+#include <algorithm>
+#include <cmath>
+
+SpectrogramAnalyzer::SpectrogramAnalyzer(const Options& opts)
+    : options(opts), fft(opts.fftSize), window(Fft::window(opts.window, opts.fftSize)),
+      sampleRate(0), channels(0), scale(1.f), offset(0), frames(0),
+      windowed(opts.fftSize), spectrum(fft.bins())
+{
+    double sum = 0.;
+    for (float w : window)
+        sum += w;
+    normalize = 20. * std::log10(sum / 2.);
+}
+
+void SpectrogramAnalyzer::format(uint32_t rate, uint32_t count, uint32_t bitsPerSample)
+{
+    sampleRate = rate;
+    channels = count;
+    scale = 1.f / static_cast<float>(1u << (bitsPerSample - 1)) / count;
+}
+
+void SpectrogramAnalyzer::process(const FLAC__int32* const buffer[], unsigned samples)
+{
+    const size_t start = pending.size();
+    pending.resize(start + samples);
+    for (unsigned i = 0; i < samples; ++i) {
+        int64_t sum = 0;
+        for (uint32_t c = 0; c < channels; ++c)
+            sum += buffer[c][i];
+        pending[start + i] = static_cast<float>(sum) * scale;
+    }
+
+    while (frames < options.frames && pending.size() - offset >= options.fftSize) {
+        frame(pending.data() + offset);
+        offset += options.hop;
+    }
+    if (offset >= pending.size() / 2) {
+        const size_t drop = std::min(offset, pending.size());
+        pending.erase(pending.begin(), pending.begin() + drop);
+        offset -= drop;
+    }
+}
+
+void SpectrogramAnalyzer::finish()
+{
+    // every frame that starts before the end gets computed
+    const size_t end = pending.size();
+    while (frames < options.frames && offset < end) {
+        pending.resize(offset + options.fftSize, 0.f);
+        frame(pending.data() + offset);
+        offset += options.hop;
+    }
+    pending.clear();
+    offset = 0;
+}
+
+void SpectrogramAnalyzer::frame(const float* samples)
+{
+    for (unsigned i = 0; i < options.fftSize; ++i)
+        windowed[i] = samples[i] * window[i];
+    fft.power(windowed.data(), spectrum.data());
+
+    const double floor = options.floor;
+    for (float p : spectrum) {
+        const double db = p > 0.f ? std::max(floor, 10. * std::log10(p) - normalize) : floor;
+        if (options.quantize) {
+            const double v = (db - floor) / -floor * 255.;
+            quantized.push_back(static_cast<uint8_t>(std::min(255., v + .5)));
+        } else {
+            values.push_back(static_cast<float>(db));
+        }
+    }
+    ++frames;
+}
+
+v8::Local<v8::Value> SpectrogramAnalyzer::result() const
+{
+    Nan::EscapableHandleScope scope;
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, Nan::New("sampleRate").ToLocalChecked(), Nan::New<v8::Number>(sampleRate));
+    Nan::Set(obj, Nan::New("fftSize").ToLocalChecked(), Nan::New<v8::Number>(options.fftSize));
+    Nan::Set(obj, Nan::New("hop").ToLocalChecked(), Nan::New<v8::Number>(options.hop));
+    Nan::Set(obj, Nan::New("bins").ToLocalChecked(), Nan::New<v8::Number>(fft.bins()));
+    Nan::Set(obj, Nan::New("frames").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(frames)));
+    Nan::Set(obj, Nan::New("format").ToLocalChecked(), Nan::New(options.quantize ? "uint8" : "float32").ToLocalChecked());
+    Nan::Set(obj, Nan::New("floor").ToLocalChecked(), Nan::New<v8::Number>(options.floor));
+    if (options.quantize) {
+        Nan::Set(obj, Nan::New("data").ToLocalChecked(), toTypedArray<uint8_t, v8::Uint8Array>(quantized));
+    } else {
+        Nan::Set(obj, Nan::New("data").ToLocalChecked(), toFloat32Array(values));
+    }
+    return scope.Escape(obj);
+}
@@ -0,0 +1,51 @@
+#ifndef SPECTROGRAM_H
+#define SPECTROGRAM_H
+
+#include "analyzer.h"
+#include "fft.h"
+
+// short-time magnitude spectrum of the channels mixed to mono, one row of
+// fftSize / 2 + 1 bins in dBFS per hop. frames past the end of the stream
+// are zero padded.
+class SpectrogramAnalyzer : public Analyzer
+{
+public:
+    struct Options
+    {
+        unsigned fftSize = 2048;
+        unsigned hop = 512;
+        Fft::Window window = Fft::Window::Hann;
+        bool quantize = false;      // uint8 from floor .. 0 dB instead of float32
+        double floor = -120.;
+        uint64_t frames = UINT64_MAX;
+    };
+
+    explicit SpectrogramAnalyzer(const Options& options);
+
+    const char* name() const override { return "spectrogram"; }
+
+    void format(uint32_t sampleRate, uint32_t channels, uint32_t bitsPerSample) override;
+    void process(const FLAC__int32* const buffer[], unsigned samples) override;
+    void finish() override;
+
+    v8::Local<v8::Value> result() const override;
+
+private:
+    void frame(const float* samples);
+
+    Options options;
+    Fft fft;
+    std::vector<float> window;
+    double normalize;           // dB of a full scale sine's peak bin
+
+    uint32_t sampleRate, channels;
+    float scale;
+    std::vector<float> pending;
+    size_t offset;
+    uint64_t frames;
+    std::vector<float> windowed, spectrum;
+    std::vector<float> values;
+    std::vector<uint8_t> quantized;
+};
+
+#endif
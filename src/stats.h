@@ -0,0 +1,64 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+
+// counters of one stream. the decoder thread and the js thread bump them
+// without taking the stream mutex and stats() reads them from js while the
+// stream runs. relaxed ordering is enough, nothing else is synchronized
+// through them, a snapshot is only ever approximately consistent
+struct DecoderStats
+{
+    typedef std::atomic<uint64_t> Counter;
+
+    // input
+    Counter bytesFed;       // handed to Feed
+    Counter bytesDecoded;   // taken by libFLAC
+    Counter inputQueued;    // fed but not yet taken
+    Counter inputPeak;
+    Counter starved;        // times the decoder waited for input
+
+    // decoding
+    Counter frames;
+    Counter samples;
+    Counter decodeNs;       // in FLAC__stream_decoder_process_single
+    Counter processNs;      // in the Processor, packing included
+
+    // output
+    Counter bytesOutput;    // pcm handed on, to js or a ring
+    Counter messagesQueued; // posted but not delivered
+    Counter messagesPeak;
+    Counter pendingBytes;   // pcm in those messages
+    Counter pendingPeak;
+    Counter wakeups;        // asyncCallback runs
+    Counter deliverNs;      // in asyncCallback
+
+    DecoderStats() { reset(); }
+
+    void reset()
+    {
+        for (Counter* c : { &bytesFed, &bytesDecoded, &inputQueued, &inputPeak, &starved,
+                            &frames, &samples, &decodeNs, &processNs,
+                            &bytesOutput, &messagesQueued, &messagesPeak, &pendingBytes, &pendingPeak,
+                            &wakeups, &deliverNs })
+            c->store(0, std::memory_order_relaxed);
+    }
+
+    static void add(Counter& counter, uint64_t value) { counter.fetch_add(value, std::memory_order_relaxed); }
+    static void sub(Counter& counter, uint64_t value) { counter.fetch_sub(value, std::memory_order_relaxed); }
+    static uint64_t get(const Counter& counter) { return counter.load(std::memory_order_relaxed); }
+
+    // adds to a gauge and raises its peak, the peak can miss a race with
+    // the other thread lowering the gauge, which only ever understates it
+    static void raise(Counter& gauge, Counter& peak, uint64_t value)
+    {
+        const uint64_t now = gauge.fetch_add(value, std::memory_order_relaxed) + value;
+        uint64_t old = peak.load(std::memory_order_relaxed);
+        while (now > old && !peak.compare_exchange_weak(old, now, std::memory_order_relaxed))
+            ;
+    }
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "trace.h"
+#include <string>
+
+Tracer::Log::Log(size_t capacity)
+    : events(capacity), count(0), lost(0)
+{
+}
+
+void Tracer::Log::add(const Event& event)
+{
+    const size_t n = count.load(std::memory_order_relaxed);
+    if (n == events.size()) {
+        lost.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    events[n] = event;
+    count.store(n + 1, std::memory_order_release);
+}
+
+Tracer::Tracer(size_t capacity)
+    : decoder(capacity), js(capacity)
+{
+    // tells the decoder threads of different streams apart in a merged trace
+    static std::atomic<uint32_t> streams(0);
+    id = ++streams;
+}
+
+v8::Local<v8::Object> Tracer::value() const
+{
+    Nan::EscapableHandleScope scope;
+    const double pid = uv_os_getpid();
+    v8::Local<v8::Array> events = Nan::New<v8::Array>();
+    uint32_t idx = 0;
+
+    auto threadName = [&](uint32_t tid, const std::string& name) {
+        v8::Local<v8::Object> args = Nan::New<v8::Object>();
+        Nan::Set(args, Nan::New("name").ToLocalChecked(), Nan::New(name).ToLocalChecked());
+        v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+        Nan::Set(obj, Nan::New("name").ToLocalChecked(), Nan::New("thread_name").ToLocalChecked());
+        Nan::Set(obj, Nan::New("ph").ToLocalChecked(), Nan::New("M").ToLocalChecked());
+        Nan::Set(obj, Nan::New("pid").ToLocalChecked(), Nan::New<v8::Number>(pid));
+        Nan::Set(obj, Nan::New("tid").ToLocalChecked(), Nan::New<v8::Number>(tid));
+        Nan::Set(obj, Nan::New("args").ToLocalChecked(), args);
+        Nan::Set(events, idx++, obj);
+    };
+    // trace timestamps are in microseconds
+    auto add = [&](const Log& log, uint32_t tid) {
+        const size_t size = log.size();
+        for (size_t i = 0; i < size; ++i) {
+            const Event& event = log[i];
+            v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+            Nan::Set(obj, Nan::New("name").ToLocalChecked(), Nan::New(event.name).ToLocalChecked());
+            Nan::Set(obj, Nan::New("ph").ToLocalChecked(), Nan::New(std::string(1, event.phase)).ToLocalChecked());
+            Nan::Set(obj, Nan::New("ts").ToLocalChecked(), Nan::New<v8::Number>(event.start / 1e3));
+            if (event.phase == 'X')
+                Nan::Set(obj, Nan::New("dur").ToLocalChecked(), Nan::New<v8::Number>(event.duration / 1e3));
+            else
+                Nan::Set(obj, Nan::New("s").ToLocalChecked(), Nan::New("t").ToLocalChecked());
+            Nan::Set(obj, Nan::New("pid").ToLocalChecked(), Nan::New<v8::Number>(pid));
+            Nan::Set(obj, Nan::New("tid").ToLocalChecked(), Nan::New<v8::Number>(tid));
+            if (event.arg) {
+                v8::Local<v8::Object> args = Nan::New<v8::Object>();
+                Nan::Set(args, Nan::New(event.arg).ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(event.value)));
+                Nan::Set(obj, Nan::New("args").ToLocalChecked(), args);
+            }
+            Nan::Set(events, idx++, obj);
+        }
+    };
+    // every stream has its own decoder thread, the js thread is shared
+    const uint32_t decoderTid = id;
+    threadName(0, "js");
+    threadName(decoderTid, "flac decoder " + std::to_string(id));
+    add(js, 0);
+    add(decoder, decoderTid);
+
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, Nan::New("feedToDecode").ToLocalChecked(), feedToDecode.value());
+    Nan::Set(obj, Nan::New("decodeToDeliver").ToLocalChecked(), decodeToDeliver.value());
+    Nan::Set(obj, Nan::New("feedToDeliver").ToLocalChecked(), feedToDeliver.value());
+    Nan::Set(obj, Nan::New("dropped").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(decoder.dropped() + js.dropped())));
+    Nan::Set(obj, Nan::New("traceEvents").ToLocalChecked(), events);
+    return scope.Escape(obj);
+}
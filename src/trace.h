@@ -0,0 +1,58 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <nan.h>
+#include "metrics.h"
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// latency tracing for one stream. input chunks are stamped when fed, pcm
+// when decoded and again when delivered to js, which gives the feed to
+// decode, decode to deliver and feed to deliver histograms. next to those
+// it keeps a bounded log of chrome trace events (feed, decode, starved,
+// deliver) for perfetto or chrome://tracing
+class Tracer
+{
+public:
+    struct Event
+    {
+        const char* name;
+        char phase;         // 'X' complete, 'i' instant
+        uint64_t start;     // uv_hrtime ns
+        uint64_t duration;
+        const char* arg;    // name of value, or null
+        uint64_t value;
+    };
+
+    // the events of one thread. a single writer appends and anyone can read
+    // what was published, so no lock. full means later events are dropped
+    class Log
+    {
+    public:
+        explicit Log(size_t capacity);
+
+        void add(const Event& event);
+        size_t size() const { return count.load(std::memory_order_acquire); }
+        const Event& operator[](size_t idx) const { return events[idx]; }
+        uint64_t dropped() const { return lost.load(std::memory_order_relaxed); }
+
+    private:
+        std::vector<Event> events;
+        std::atomic<size_t> count;
+        std::atomic<uint64_t> lost;
+    };
+
+    explicit Tracer(size_t capacity);
+
+    Log decoder, js;
+    Histogram feedToDecode, decodeToDeliver, feedToDeliver;
+
+    // { feedToDecode, decodeToDeliver, feedToDeliver, dropped, traceEvents }
+    v8::Local<v8::Object> value() const;
+
+private:
+    uint32_t id;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "transcode.h"
+#include <algorithm>
+#include <cmath>
+
+constexpr unsigned TranscodeAnalyzer::fftSize;
+
+TranscodeAnalyzer::TranscodeAnalyzer()
+    : sampleRate(0), channels(0), scale(1.f), fft(fftSize),
+      window(Fft::window(Fft::Window::Blackman, fftSize)), frame(fftSize), spectrum(fft.bins()),
+      fill(0), sum(fft.bins(), 0.), frames(0), cutoff(0.), drop(0.), steepness(0.), score(0.)
+{
+}
+
+void TranscodeAnalyzer::format(uint32_t rate, uint32_t count, uint32_t bitsPerSample)
+{
+    // the spectrum keeps accumulating, a rate change mid stream is rare
+    // enough not to bother
+    sampleRate = rate;
+    channels = count;
+    scale = 1.f / static_cast<float>(1u << (bitsPerSample - 1)) / count;
+}
+
+void TranscodeAnalyzer::process(const FLAC__int32* const buffer[], unsigned samples)
+{
+    for (unsigned i = 0; i < samples; ++i) {
+        int64_t mixed = 0;
+        for (uint32_t c = 0; c < channels; ++c)
+            mixed += buffer[c][i];
+        frame[fill] = static_cast<float>(mixed) * scale * window[fill];
+        if (++fill == fftSize) {
+            fft.power(frame.data(), spectrum.data());
+            for (size_t k = 0; k < spectrum.size(); ++k)
+                sum[k] += spectrum[k];
+            ++frames;
+            fill = 0;
+        }
+    }
+}
+
+void TranscodeAnalyzer::finish()
+{
+    if (!frames || !sampleRate)
+        return;
+
+    const size_t bins = sum.size();
+    const double binWidth = static_cast<double>(sampleRate) / fftSize;
+    const double nyquist = sampleRate / 2.;
+    auto binOf = [&](double freq) {
+        return std::min(bins - 1, static_cast<size_t>(std::max(0., freq / binWidth)));
+    };
+
+    // long-term level per bin, smoothed over about 100Hz
+    std::vector<double> level(bins);
+    for (size_t k = 0; k < bins; ++k)
+        level[k] = 10. * std::log10(sum[k] / frames + 1e-30);
+    const size_t radius = std::max<size_t>(1, static_cast<size_t>(50. / binWidth));
+    std::vector<double> smooth(bins);
+    for (size_t k = 0; k < bins; ++k) {
+        const size_t lo = k > radius ? k - radius : 0, hi = std::min(bins - 1, k + radius);
+        double s = 0.;
+        for (size_t j = lo; j <= hi; ++j)
+            s += level[j];
+        smooth[k] = s / (hi - lo + 1);
+    }
+
+    std::vector<double> prefix(bins + 1, 0.);
+    for (size_t k = 0; k < bins; ++k)
+        prefix[k + 1] = prefix[k] + smooth[k];
+    auto mean = [&](double from, double to) {
+        const size_t lo = binOf(from), hi = binOf(to);
+        return (prefix[hi + 1] - prefix[lo]) / (hi - lo + 1);
+    };
+
+    // the cutoff is where the level drops the most between the bands a
+    // little below and a little above. natural rolloff only takes a few dB
+    // over that distance, a lowpass tens of them
+    const double gap = 300., span = 1000.;
+    double best = 0., center = nyquist;
+    for (double freq = 2000.; freq < nyquist - gap - binWidth; freq += binWidth) {
+        const double d = mean(freq - span, freq - gap) - mean(freq + gap, std::min(nyquist, freq + span));
+        if (d > best) {
+            best = d;
+            center = freq;
+        }
+    }
+    drop = best;
+    if (drop < 10.) {
+        cutoff = nyquist;
+        drop = steepness = score = 0.;
+        return;
+    }
+    const double below = mean(center - span, center - gap);
+    const double above = below - drop;
+
+    // the cutoff proper is the crossing half way down, the transition runs
+    // from 6dB under the passband to the band above
+    size_t k = binOf(center - gap);
+    while (k < bins - 1 && smooth[k] > below - drop / 2.)
+        ++k;
+    cutoff = k * binWidth;
+    size_t start = k, end = k;
+    while (start > 0 && smooth[start] < below - 6.)
+        --start;
+    while (end < bins - 1 && smooth[end] > above + 6.)
+        ++end;
+    const double width = std::max(binWidth, (end - start) * binWidth) / 1000.;
+    steepness = drop / width;
+
+    auto ramp = [](double v, double from, double to) {
+        return std::min(1., std::max(0., (v - from) / (to - from)));
+    };
+    score = ramp(drop, 15., 35.) * ramp(steepness, 10., 50.);
+}
+
+v8::Local<v8::Value> TranscodeAnalyzer::result() const
+{
+    Nan::EscapableHandleScope scope;
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, Nan::New("score").ToLocalChecked(), Nan::New<v8::Number>(score));
+    Nan::Set(obj, Nan::New("cutoff").ToLocalChecked(), Nan::New<v8::Number>(cutoff));
+    Nan::Set(obj, Nan::New("drop").ToLocalChecked(), Nan::New<v8::Number>(drop));
+    Nan::Set(obj, Nan::New("steepness").ToLocalChecked(), Nan::New<v8::Number>(steepness));
+    return scope.Escape(obj);
+}
@@ -0,0 +1,37 @@
+#ifndef TRANSCODE_H
+#define TRANSCODE_H
+
+#include "analyzer.h"
+#include "fft.h"
+
+// looks for the lowpass a lossy encoder leaves in the long-term spectrum:
+// a cutoff below nyquist with a steep drop into a near empty band above it
+class TranscodeAnalyzer : public Analyzer
+{
+public:
+    TranscodeAnalyzer();
+
+    const char* name() const override { return "transcode"; }
+
+    void format(uint32_t sampleRate, uint32_t channels, uint32_t bitsPerSample) override;
+    void process(const FLAC__int32* const buffer[], unsigned samples) override;
+    void finish() override;
+
+    v8::Local<v8::Value> result() const override;
+
+    static constexpr unsigned fftSize = 4096;
+
+private:
+    uint32_t sampleRate, channels;
+    float scale;
+    Fft fft;
+    std::vector<float> window;
+    std::vector<float> frame, spectrum;
+    unsigned fill;
+    std::vector<double> sum;
+    uint64_t frames;
+
+    double cutoff, drop, steepness, score;
+};
+
+#endif
@@ -0,0 +1,100 @@
+/*global require,process,console*/
+
+// decode throughput for a corpus under different decoder settings:
+//
+//   node test/bench.js <file or directory>...
+//
+// streaming runs go through createReadStream and FlacDecoder, file runs
+// decode on the thread pool without handing any pcm to js.
+
+const { FlacDecoder, analyze } = require("..");
+const { createReadStream, readdirSync, statSync } = require("fs");
+const path = require("path");
+
+function collect(paths) {
+    let files = [];
+    for (const p of paths) {
+        if (statSync(p).isDirectory()) {
+            files = files.concat(collect(readdirSync(p).map(name => path.join(p, name))));
+        } else if (/\.flac$/i.test(p)) {
+            files.push(p);
+        }
+    }
+    return files;
+}
+
+function stream(file, options) {
+    return new Promise((resolve, reject) => {
+        let format, bytes = 0;
+        createReadStream(file)
+            .on("error", reject)
+            .pipe(new FlacDecoder(options))
+            .on("format", f => { format = f; })
+            .on("data", chunk => { bytes += chunk.length; })
+            .on("error", reject)
+            .on("end", () => {
+                const frameSize = format ? format.channels * format.bitDepth / 8 : 1;
+                resolve(format ? bytes / frameSize / format.sampleRate : 0);
+            });
+    });
+}
+
+function file(file, options) {
+    return analyze(file, options).then(result => {
+        return result.sampleRate ? result.totalSamples / result.sampleRate : 0;
+    });
+}
+
+const runs = [
+    { name: "stream", run: f => stream(f, {}) },
+    { name: "stream md5", run: f => stream(f, { md5: true }) },
+    { name: "stream trusted", run: f => stream(f, { trusted: true }) },
+    { name: "file", run: f => file(f, {}) },
+    { name: "file md5 (verify)", run: f => file(f, { verify: true }) }
+];
+
+// md5 on against md5 off, the rest of the settings being equal. trusted
+// differs from the default only in skipping the metadata
+const md5Pairs = [
+    { name: "stream", off: "stream", on: "stream md5" },
+    { name: "file", off: "file", on: "file md5 (verify)" }
+];
+
+async function main() {
+    const files = collect(process.argv.slice(2));
+    if (!files.length) {
+        console.error("usage: node test/bench.js <file or directory>...");
+        process.exit(1);
+    }
+    const inputBytes = files.reduce((sum, f) => sum + statSync(f).size, 0);
+
+    // warm the page cache with the whole corpus so the first run doesn't
+    // pay for the disk
+    for (const f of files)
+        await file(f, {});
+
+    console.log(`${files.length} files, ${(inputBytes / 1048576).toFixed(1)} MB`);
+    const times = {};
+    for (const { name, run } of runs) {
+        const start = process.hrtime.bigint();
+        let audio = 0;
+        for (const f of files)
+            audio += await run(f);
+        const seconds = Number(process.hrtime.bigint() - start) / 1e9;
+        console.log(`${name.padEnd(20)} ${seconds.toFixed(2).padStart(8)}s `
+                    + `${(inputBytes / 1048576 / seconds).toFixed(1).padStart(8)} MB/s `
+                    + `${(audio / seconds).toFixed(0).padStart(6)}x realtime`);
+        times[name] = seconds;
+    }
+
+    for (const { name, off, on } of md5Pairs) {
+        const cost = (times[on] - times[off]) / times[off] * 100;
+        console.log(`md5 ${name.padEnd(16)} ${(times[on] - times[off]).toFixed(2).padStart(8)}s `
+                    + `${cost.toFixed(1).padStart(8)} % over md5 off`);
+    }
+}
+
+main().catch(err => {
+    console.error(err);
+    process.exit(1);
+});